@@ -1,6 +1,7 @@
 #include "App.h"
 #include "MTVRhythmSpace.h"
 #include <mutex>
+#include <system_error>
 
 using namespace std::placeholders;
 
@@ -48,8 +49,7 @@ void rg::App::cleanup()
   std::lock_guard<std::mutex> lock(mMutex);
   if (mFutureGetRandomPatternCloseToMtv.valid())
     mFutureGetRandomPatternCloseToMtv.wait();
-  if (mFutureRhythmSpaceReset.valid())
-    mFutureRhythmSpaceReset.wait();
+  cancelMtvRhythmSpaceFill();
 }
 
 void rg::App::keyUp(ci::app::KeyEvent event)
@@ -66,51 +66,105 @@ void rg::App::resetMtvRhythmSpace(const TimeSignature& ts, UnitRef unit)
 {
   std::lock_guard<std::mutex> lock(mMutex);
 
-  // fail if there's already a pending request for a mtv rhythm space fill
-  if ((mMtvRhythmSpace && !mMtvRhythmSpace->ready()) || mFutureRhythmSpaceReset.valid()) {
+  // fail if the current space is still being queried asynchronously
+  if (mFutureGetRandomPatternCloseToMtv.valid()) {
     onMtvRhythmSpaceReset(true);
     return;
   }
 
-  // delete the previous space and create new one
-  if (mMtvRhythmSpace) delete mMtvRhythmSpace;
-  mMtvRhythmSpace = new MTVRhythmSpace(ts, unit);
+  // requesting the space that is being filled again keeps its fill going
+  if (mFutureRhythmSpaceReset.valid() && mMtvRhythmSpace == mSpaceRegistry.find(ts, unit))
+    return;
+
+  // otherwise the pending fill is stale, only the last requested space gets filled
+  cancelMtvRhythmSpaceFill();
+
+  // switch to the registered space (which might already be filled) or to a new one
+  mMtvRhythmSpace = mSpaceRegistry.get(ts, unit);
 
   TensionCanvasRef canvas = mViewCtrl->getTensionCanvas();
-  ControlBarRef controlBar = mViewCtrl->getControlBar();
   RhythmPatternPlayer& player = mPatternPlayer;
+  player.setBeatDuration(MeterTables::get(ts, unit)->getNStepsPerBeat());
+
+  if (mMtvRhythmSpace->ready()) {
+    onMtvRhythmSpaceReset();
+    return;
+  }
 
   if (canvas) {
     canvas->setLoadingProgress(0.0);
     canvas->setLoading(true);
   }
 
-  if (controlBar) {
-    controlBar->setDisabled(true);
-  }
-
-  player.setBeatDuration(ts.getBeatUnit()->convertExact(1, unit));
-
+  // the control bar stays enabled, so that a newer request can preempt this fill
   std::function<void(double)> updateProgress = std::bind(
     &TensionCanvas::setLoadingProgress, canvas.get(), _1
   );
 
-  mFutureRhythmSpaceReset = std::async(std::launch::async, std::bind(
-    &MTVRhythmSpace::fill, mMtvRhythmSpace, updateProgress));
+  // open the space from its file if it has already been computed, otherwise fill 
+  // it on all hardware threads (0) and save it for the next time
+  MTVRhythmSpaceRef space = mMtvRhythmSpace;
+  const std::string path = getMtvRhythmSpaceFilePath(*space);
+  CancellationTokenRef token = std::make_shared<CancellationToken>();
+  mFillCancellationToken = token;
+
+  // the index makes the closest pattern queries of the canvas skip the scan. It's built by open() or 
+  // fill() before the space becomes ready, so the canvas never queries it while it's being built.
+  space->enableIndex();
+
+  mFutureRhythmSpaceReset = std::async(std::launch::async, [space, path, updateProgress, token]() {
+    if (!path.empty() && space->open(path)) {
+      updateProgress(1.0);
+      return;
+    }
+
+    if (!space->fill(updateProgress, 0, token.get()) || path.empty())
+      return;
+
+    try {
+      space->save(path);
+    } catch (const std::runtime_error&) {
+      // not fatal, the space is just computed again next time
+    }
+  });
+}
+
+void rg::App::cancelMtvRhythmSpaceFill()
+{
+  if (!mFutureRhythmSpaceReset.valid())
+    return;
+
+  // the fill stops at its next chunk boundary, so this only waits for the chunks in progress
+  mFillCancellationToken->cancel();
+  mFutureRhythmSpaceReset.wait();
+  mFutureRhythmSpaceReset = std::shared_future<void>();
+  mFillCancellationToken.reset();
+}
+
+std::string rg::App::getMtvRhythmSpaceFilePath(const MTVRhythmSpace& space) const
+{
+  // an empty path if the directory can't be created (e.g. an installed app), the space is then filled every time
+  const ci::fs::path dir = ci::app::getAppPath() / "spaces";
+  std::error_code error;
+  ci::fs::create_directories(dir, error);
+  if (error)
+    return std::string();
+
+  return (dir / space.getFileName()).string();
 }
 
 void rg::App::setPatternClosestToMtv()
 {
-  MTVRhythmSpace * space = mMtvRhythmSpace;
+  MTVRhythmSpaceRef space = mMtvRhythmSpace;
   TensionCanvasRef canvas = mViewCtrl->getTensionCanvas();
   SequencerRef sequencer = mViewCtrl->getSequencer();
 
-  if (!space || !sequencer) {
+  if (!space || !sequencer || !space->ready()) {
     return;
   }
 
   const Tension * const mtv = canvas->getFreeTensionLine();
-  PatternId pattern = space->getClosestPattern(mtv);
+  PatternId pattern = space->getClosestPattern(mtv, mQueryContext);
   sequencer->setPattern(pattern);
 }
 
@@ -118,7 +172,7 @@ void rg::App::setRandomPatternCloseToMtv()
 {
   std::lock_guard<std::mutex> lock(mMutex);
 
-  MTVRhythmSpace * space = mMtvRhythmSpace;
+  MTVRhythmSpaceRef space = mMtvRhythmSpace;
   TensionCanvasRef canvas = mViewCtrl->getTensionCanvas();
   SequencerRef sequencer = mViewCtrl->getSequencer();
 
@@ -131,9 +185,15 @@ void rg::App::setRandomPatternCloseToMtv()
   if (controlBar) controlBar->setDisabled(true);
   sequencer->setDisabled(true);
 
-  const Tension * const mtv = canvas->getFreeTensionLine();
-  mFutureGetRandomPatternCloseToMtv = std::async(std::launch::async, std::bind(
-    &MTVRhythmSpace::getRandomPatternCloseTo, mMtvRhythmSpace, mtv, 0.1f));
+  // copy the target, as the tension line may change while the query runs
+  const Tension * const freeMtv = canvas->getFreeTensionLine();
+  const std::vector<Tension> mtv(freeMtv, freeMtv + space->getDimensions());
+  std::shared_ptr<const MTVRhythmSpace> constSpace = space;
+  MTVRhythmSpace::QueryContext& ctx = mAsyncQueryContext;
+
+  mFutureGetRandomPatternCloseToMtv = std::async(std::launch::async, [constSpace, mtv, &ctx]() {
+    return constSpace->getRandomPatternCloseTo(mtv.data(), ctx, 0.1f);
+  });
 }
 
 void rg::App::toggleRhythmPatternPlayerPlayback()
@@ -163,6 +223,7 @@ void rg::App::checkFutures()
     if (status == std::future_status::ready) {
       onMtvRhythmSpaceReset();
       mFutureRhythmSpaceReset = std::shared_future<void>();
+      mSpaceRegistry.evict();  // the space holds its memory now that it's ready
     }
   }
 
@@ -216,7 +277,7 @@ void rg::App::setupSignals()
 
 void rg::App::onTensionLineChanged(const Tension * const freeMtv, const Tension * const lockedMtv, int nSteps)
 {
-  MTVRhythmSpace * space = mMtvRhythmSpace;
+  MTVRhythmSpaceRef space = mMtvRhythmSpace;
   TensionCanvasRef canvas = mViewCtrl->getTensionCanvas();
   
   if (!canvas) {
@@ -234,7 +295,7 @@ void rg::App::onTensionLineChanged(const Tension * const freeMtv, const Tension
 
 void rg::App::onMtvRhythmSpaceReset(bool error)
 {
-  MTVRhythmSpace * space = mMtvRhythmSpace;
+  MTVRhythmSpaceRef space = mMtvRhythmSpace;
   TensionCanvasRef canvas = mViewCtrl->getTensionCanvas();
   SequencerRef sequencer = mViewCtrl->getSequencer();
   ControlBarRef controlBar = mViewCtrl->getControlBar();
@@ -286,7 +347,7 @@ void rg::App::onPatternChanged(PatternId pattern)
 {
   SequencerRef sequencer = mViewCtrl->getSequencer();
   TensionCanvasRef canvas = mViewCtrl->getTensionCanvas();
-  MTVRhythmSpace * space = mMtvRhythmSpace;
+  MTVRhythmSpaceRef space = mMtvRhythmSpace;
 
   if (sequencer) {
     sequencer->setPattern(pattern);
@@ -305,14 +366,14 @@ void rg::App::onPatternChanged(PatternId pattern)
 
 void rg::App::onTimeSignatureRequest(const TimeSignature& ts)
 {
-  MTVRhythmSpace * space = mMtvRhythmSpace;
+  MTVRhythmSpaceRef space = mMtvRhythmSpace;
   UnitRef unit = space ? space->getStepUnit() : Unit::QUAVER;
   resetMtvRhythmSpace(ts, unit);
 }
 
 void rg::App::onStepUnitRequest(UnitRef unit)
 {
-  MTVRhythmSpace * space = mMtvRhythmSpace;
+  MTVRhythmSpaceRef space = mMtvRhythmSpace;
   TimeSignature ts = space ? space->getTimeSignature() : TimeSignature(4, 4);
   resetMtvRhythmSpace(ts, unit);
 }
@@ -7,8 +7,8 @@
 #include "MainViewController.h"
 #include "KeyboardController.h"
 #include "RhythmPatternPlayer.h"
-
-class MTVRhythmSpace;
+#include "MTVRhythmSpace.h"
+#include "MTVRhythmSpaceRegistry.h"
 
 namespace rg {
   class App : public ci::app::App 
@@ -24,8 +24,8 @@ namespace rg {
     void keyUp(ci::app::KeyEvent event) override;
     void keyDown(ci::app::KeyEvent event) override;
 
-    // tries to create a new mtv rhythm space and fills it asynchronously, returns 
-    // false if it failed to do so (because current space is busy)
+    // tries to switch to the mtv rhythm space of the given meter, filling it asynchronously if it's not in 
+    // the registry yet (a pending fill is cancelled), fails if the current space is being queried
     void resetMtvRhythmSpace(const TimeSignature& ts, UnitRef unit);
 
     void setPatternClosestToMtv();
@@ -37,6 +37,10 @@ namespace rg {
 
   protected:
     void checkFutures();  // called at every update()
+    void cancelMtvRhythmSpaceFill();  // cancels the pending fill (if any) and waits for it, mMutex must be locked
+    // returns the path of the file the given space is saved to and opened from (next to the app), or an empty 
+    // path if spaces can't be saved there
+    std::string getMtvRhythmSpaceFilePath(const MTVRhythmSpace& space) const;
     void setupTheme();
     void setupSignals();
 
@@ -52,13 +56,17 @@ namespace rg {
   private:
     std::mutex mMutex;
     std::shared_future<void> mFutureRhythmSpaceReset;
+    CancellationTokenRef mFillCancellationToken;  // cancels the fill behind mFutureRhythmSpaceReset
     std::shared_future<PatternId> mFutureGetRandomPatternCloseToMtv;
 
     po::scene::SceneRef mScene;
     MainViewControllerRef mViewCtrl;
     KeyboardController mKbdController;
     RhythmPatternPlayer mPatternPlayer;
-    MTVRhythmSpace * mMtvRhythmSpace;
+    MTVRhythmSpaceRegistry mSpaceRegistry;  // keeps the recently used spaces filled (the query contexts are outside its budget)
+    MTVRhythmSpaceRef mMtvRhythmSpace;
+    MTVRhythmSpace::QueryContext mQueryContext;       // used by queries on the main thread
+    MTVRhythmSpace::QueryContext mAsyncQueryContext;  // used by the (one at a time) async queries
   };
 }
 
@@ -65,10 +65,12 @@ void rg::RhythmPatternPlayer::stopPolling(bool sync)
 
 void rg::RhythmPatternPlayer::setPattern(const RhythmPattern& pattern)
 {
-  const TimeSignature& timesig = mPattern.getTimeSignature();
-  const double measureInCrotchets = timesig.getMeasureDuration(Unit::CROTCHET);
+  // the meter tables are shared with the pattern, copying it doesn't rebuild them
+  const MeterTables& meterTables = pattern.getMeterTables();
+  const double measureInCrotchets = meterTables.getTimeSignature().getMeasureDuration(Unit::CROTCHET);
   std::lock_guard<std::mutex> lock(mMutex);
   mPatternDuration = 60.0 / mBpm * measureInCrotchets;
+  mNStepsPerBeat = meterTables.getNStepsPerBeat();
   mPattern = pattern;
 }
 
@@ -0,0 +1,51 @@
+#include "AliasTable.h"
+#include <numeric>
+#include <stdexcept>
+
+
+AliasTable::AliasTable(const std::vector<double>& weights) :
+  mWeights(weights),
+  mProbabilities(weights.size()),
+  mAliases(weights.size())
+{
+  const size_t n = weights.size();
+  const double total = std::accumulate(weights.begin(), weights.end(), 0.0);
+
+  if (n == 0 || !(total > 0.0))
+    throw std::runtime_error("AliasTable requires weights with a positive sum");
+
+  // scale the weights so that the average column is 1, then fill the small columns with the large ones
+  std::vector<double> scaled(n);
+  std::vector<size_t> small, large;
+
+  for (size_t i = 0; i < n; ++i) {
+    mWeights[i] /= total;
+    scaled[i] = mWeights[i] * n;
+    (scaled[i] < 1.0 ? small : large).push_back(i);
+  }
+
+  while (!small.empty() && !large.empty()) {
+    const size_t s = small.back(), l = large.back();
+    small.pop_back();
+
+    mProbabilities[s] = scaled[s];
+    mAliases[s] = l;
+    scaled[l] -= 1.0 - scaled[s];
+
+    if (scaled[l] < 1.0) {
+      large.pop_back();
+      small.push_back(l);
+    }
+  }
+
+  // the remaining columns are full (up to rounding errors)
+  for (size_t i : large) { mProbabilities[i] = 1.0; mAliases[i] = i; }
+  for (size_t i : small) { mProbabilities[i] = 1.0; mAliases[i] = i; }
+}
+
+size_t AliasTable::draw(std::mt19937& random) const
+{
+  const size_t column = std::uniform_int_distribution<size_t>(0, mProbabilities.size() - 1)(random);
+  const double u = std::uniform_real_distribution<double>(0.0, 1.0)(random);
+  return u < mProbabilities[column] ? column : mAliases[column];
+}
@@ -0,0 +1,26 @@
+#pragma once
+
+#include <vector>
+#include <random>
+#include <cstddef>
+
+// Walker/Vose alias table: draws an index with probability proportional to its weight in O(1), 
+// with one uniform index and one uniform real per draw. Built in O(n).
+class AliasTable
+{
+public:
+  AliasTable() {}
+  // the weights must be non-negative with a positive sum
+  explicit AliasTable(const std::vector<double>& weights);
+
+  size_t draw(std::mt19937& random) const;
+
+  inline size_t size() const { return mProbabilities.size(); }
+  // returns the (normalized) probability of drawing the given index
+  inline double getProbability(size_t ix) const { return mWeights[ix]; }
+
+private:
+  std::vector<double> mWeights;        // normalized weights
+  std::vector<double> mProbabilities;  // probability of keeping each column's own index
+  std::vector<size_t> mAliases;        // index drawn otherwise
+};
@@ -0,0 +1,21 @@
+#pragma once
+
+#include <atomic>
+#include <memory>
+
+typedef std::shared_ptr<class CancellationToken> CancellationTokenRef;
+
+
+// Flag shared between the requester of a long-running task and the task, which checks it at 
+// points where it can stop cleanly (e.g. MTVRhythmSpace::fill between chunks).
+class CancellationToken
+{
+public:
+  CancellationToken() : mCancelled(false) {}
+
+  inline void cancel() { mCancelled = true; }
+  inline bool isCancelled() const { return mCancelled; }
+
+private:
+  std::atomic<bool> mCancelled;
+};
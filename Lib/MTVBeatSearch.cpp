@@ -0,0 +1,170 @@
+#include "MTVBeatSearch.h"
+#include "MTVDistanceKernel.h"
+#include <algorithm>
+#include <limits>
+#include <stdexcept>
+
+
+MTVBeatSearch::MTVBeatSearch(const MTVBeatTable& table) :
+  mTable(table)
+{
+  if (!table.isValid())
+    throw std::runtime_error("MTVBeatSearch requires a valid beat table");
+
+  const int nBeats = table.getNBeats();
+  const int nSlices = table.getNSlices();
+  const int lastBeat = nBeats - 1;
+
+  // collect all tensions that can be carried into a beat (including the wrap into the first beat)
+  mStates.push_back(MTV_BEAT_TABLE_NO_CARRY);
+
+  for (int beat = 0; beat < nBeats; ++beat) {
+    for (int slice = 0; slice < nSlices; ++slice) {
+      const MTVBeatTable::Entry& entry = table.getEntry(beat, slice);
+      if (std::find(mStates.begin(), mStates.end(), entry.carryOut) == mStates.end())
+        mStates.push_back(entry.carryOut);
+      if (beat == lastBeat && std::find(mStates.begin(), mStates.end(), entry.wrapTension) == mStates.end())
+        mStates.push_back(entry.wrapTension);
+    }
+  }
+
+  const int nStates = (int)mStates.size();
+  mCarryOutIx.resize((size_t)nBeats * nSlices);
+  mWrapIx.resize((size_t)nSlices * nStates);
+
+  for (int beat = 0; beat < nBeats; ++beat) {
+    for (int slice = 0; slice < nSlices; ++slice)
+      mCarryOutIx[(size_t)beat * nSlices + slice] = getStateIx(table.getEntry(beat, slice).carryOut);
+  }
+
+  for (int slice = 0; slice < nSlices; ++slice) {
+    const MTVBeatTable::Entry& entry = table.getEntry(lastBeat, slice);
+    for (int stateIx = 0; stateIx < nStates; ++stateIx) {
+      // the carry into the last beat is only known for measures of more than one beat
+      const bool carried = nBeats > 1 && stateIx != 0;
+      const bool sounds = entry.wrapSounding == 1 || (entry.wrapSounding == 2 && carried);
+      mWrapIx[(size_t)slice * nStates + stateIx] = sounds ? getStateIx(entry.wrapTension) : 0;
+    }
+  }
+}
+
+PatternId MTVBeatSearch::findClosest(const Tension * const mtv, double * squaredDistanceOut) const
+{
+  const int32_t inf = std::numeric_limits<int32_t>::max();
+  const int nBeats = mTable.getNBeats();
+  const int nSlices = mTable.getNSlices();
+  const int nStates = (int)mStates.size();
+  const int nStepsPerBeat = mTable.getNStepsPerBeat();
+
+  // beat costs per [beat, slice, state]
+  std::vector<int32_t> costs((size_t)nBeats * nSlices * nStates);
+  for (int beat = 0; beat < nBeats; ++beat)
+    for (int slice = 0; slice < nSlices; ++slice)
+      for (int stateIx = 0; stateIx < nStates; ++stateIx)
+        costs[((size_t)beat * nSlices + slice) * nStates + stateIx] = getBeatCost(mtv, beat, slice, stateIx);
+
+  auto cost = [&](int beat, int slice, int stateIx) {
+    return costs[((size_t)beat * nSlices + slice) * nStates + stateIx];
+  };
+
+  // equal costs go to the lowest pattern id, like in a scan of the points
+  auto isBetter = [](int32_t c, PatternId pattern, int32_t bestC, PatternId bestPattern) {
+    return c < bestC || (c == bestC && pattern < bestPattern);
+  };
+
+  int32_t bestCost = inf;
+  PatternId bestPattern = EMPTY_RHYTHM_PATTERN;
+
+  if (nBeats == 1) {
+    // the only beat wraps into itself, the carry into it only depends on its own slice
+    for (int slice = 0; slice < nSlices; ++slice) {
+      const int32_t c = cost(0, slice, mWrapIx[(size_t)slice * nStates]);
+      if (c < bestCost) {
+        bestCost = c;
+        bestPattern = (PatternId)slice;
+      }
+    }
+  } else {
+    // the dp runs from the last beat backwards: dp[state] is the min cost of beats [beat, nBeats) given
+    // the state carried into beat, and dpPattern[state] the lowest pattern of those beats reaching it.
+    // Later beats are more significant in the pattern id and earlier beats only see the carried state, 
+    // so the lowest pattern of the later beats also gives the lowest full pattern
+    std::vector<int32_t> dp(nStates), nextDp(nStates);
+    std::vector<PatternId> dpPattern(nStates), nextDpPattern(nStates);
+    const int lastBeat = nBeats - 1;
+
+    // guess the tension wrapped into the first beat and only accept last beats that wrap the same
+    for (int wrapIx = 0; wrapIx < nStates; ++wrapIx) {
+      std::fill(dp.begin(), dp.end(), inf);
+
+      for (int stateIx = 0; stateIx < nStates; ++stateIx) {
+        for (int slice = 0; slice < nSlices; ++slice) {
+          if (mWrapIx[(size_t)slice * nStates + stateIx] != wrapIx) continue;
+          const int32_t c = cost(lastBeat, slice, stateIx);
+          const PatternId pattern = (PatternId)slice << (lastBeat * nStepsPerBeat);
+          if (isBetter(c, pattern, dp[stateIx], dpPattern[stateIx])) {
+            dp[stateIx] = c;
+            dpPattern[stateIx] = pattern;
+          }
+        }
+      }
+
+      for (int beat = lastBeat - 1; beat >= 1; --beat) {
+        std::fill(nextDp.begin(), nextDp.end(), inf);
+
+        for (int stateIx = 0; stateIx < nStates; ++stateIx) {
+          for (int slice = 0; slice < nSlices; ++slice) {
+            const int carryIx = mCarryOutIx[(size_t)beat * nSlices + slice];
+            if (dp[carryIx] == inf) continue;
+            const int32_t c = dp[carryIx] + cost(beat, slice, stateIx);
+            const PatternId pattern = dpPattern[carryIx] | ((PatternId)slice << (beat * nStepsPerBeat));
+            if (isBetter(c, pattern, nextDp[stateIx], nextDpPattern[stateIx])) {
+              nextDp[stateIx] = c;
+              nextDpPattern[stateIx] = pattern;
+            }
+          }
+        }
+
+        dp.swap(nextDp);
+        dpPattern.swap(nextDpPattern);
+      }
+
+      // first beat, carrying in the guessed wrap
+      for (int slice = 0; slice < nSlices; ++slice) {
+        const int carryIx = mCarryOutIx[slice];
+        if (dp[carryIx] == inf) continue;
+        const int32_t c = dp[carryIx] + cost(0, slice, wrapIx);
+        const PatternId pattern = dpPattern[carryIx] | (PatternId)slice;
+        if (isBetter(c, pattern, bestCost, bestPattern)) {
+          bestCost = c;
+          bestPattern = pattern;
+        }
+      }
+    }
+  }
+
+  if (squaredDistanceOut)
+    *squaredDistanceOut = unitsToSquaredDistance(bestCost);
+
+  return bestPattern;
+}
+
+int MTVBeatSearch::getStateIx(Tension carry) const
+{
+  return (int)(std::find(mStates.begin(), mStates.end(), carry) - mStates.begin());
+}
+
+int32_t MTVBeatSearch::getBeatCost(const Tension * const mtv, int beat, int slice, int stateIx) const
+{
+  const int nStepsPerBeat = mTable.getNStepsPerBeat();
+  const Tension * const target = mtv + beat * nStepsPerBeat;
+  const Tension * const row = mTable.getRow(beat, slice);
+  const int nCarriedSteps = stateIx != 0 ? mTable.getEntry(beat, slice).firstEventLength : 0;
+  const Tension carry = mStates[stateIx];
+  int32_t units = 0;
+
+  for (int pos = 0; pos < nStepsPerBeat; ++pos)
+    units += getSquaredDiffUnits(target[pos], pos < nCarriedSteps ? carry : row[pos]);
+
+  return units;
+}
@@ -0,0 +1,34 @@
+#pragma once
+
+#include "Types.h"
+#include "MTVBeatTable.h"
+#include <vector>
+
+
+// Exact nearest-pattern search over an implicit MTV space. Instead of enumerating all 2^N patterns,
+// it runs a dynamic program over the beats of a MTVBeatTable: the state passed from one beat to the
+// next is the tension carried into it, and the first beat is solved once per possible wrap-around
+// tension (which must then be matched by the last beat). Runs in O(beats * slices * states^2) per query.
+// Costs are counted in the units of the distance kernels (see MTV_DISTANCE_UNITS), so the distances
+// and the ties are the same as in a scan of the materialized points.
+class MTVBeatSearch
+{
+public:
+  explicit MTVBeatSearch(const MTVBeatTable& table);
+
+  // returns the pattern whose mtv is closest to the given point (ties are resolved by lowest pattern
+  // id) and optionally its squared (not normalized) distance
+  PatternId findClosest(const Tension * const mtv, double * squaredDistanceOut = nullptr) const;
+
+protected:
+  int getStateIx(Tension carry) const;
+
+  // returns the squared distance (in distance units) of the given beat/slice to the target, given the carried-in state
+  int32_t getBeatCost(const Tension * const mtv, int beat, int slice, int stateIx) const;
+
+private:
+  const MTVBeatTable& mTable;
+  std::vector<Tension> mStates;    // possible carried-in tensions (first is MTV_BEAT_TABLE_NO_CARRY)
+  std::vector<int> mCarryOutIx;    // state index of the carry out of [beat, slice]
+  std::vector<int> mWrapIx;        // state index of the wrap of [slice, stateIx] (last beat only)
+};
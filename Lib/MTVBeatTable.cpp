@@ -0,0 +1,120 @@
+#include "MTVBeatTable.h"
+#include "RhythmPattern.h"
+#include <algorithm>
+
+
+MTVBeatTable::MTVBeatTable(
+  const TimeSignature& ts,
+  UnitRef stepUnit,
+  const MetricalSalienceProfile& prf,
+  MetricalSalienceRange salienceRange
+) :
+  mValid(false),
+  mNSteps(ts.getExactMeasureDuration(stepUnit)),
+  mNBeats(0),
+  mNStepsPerBeat(ts.getBeatUnit()->convertExact(1, stepUnit)),
+  mNSlices(0)
+{
+  ts.checkStepUnit(stepUnit);
+
+  if (mNStepsPerBeat > MTV_BEAT_TABLE_MAX_STEPS_PER_BEAT || mNSteps % mNStepsPerBeat != 0)
+    return;
+
+  // the factorization only holds if no natural duration crosses a beat boundary
+  const NaturalDurationTable& naturalDurations = MeterTables::get(ts, stepUnit)->getNaturalDurations(true);
+  for (int step = 0; step < mNSteps; ++step) {
+    if ((step % mNStepsPerBeat) + naturalDurations.durations[step] > mNStepsPerBeat)
+      return;
+  }
+
+  mNBeats = mNSteps / mNStepsPerBeat;
+  mNSlices = 1 << mNStepsPerBeat;
+  mRows.resize((size_t)mNBeats * mNSlices * mNStepsPerBeat);
+  mEntries.resize((size_t)mNBeats * mNSlices);
+
+  RhythmPattern rp(ts, stepUnit);
+  MusicalEventBuffer events;
+
+  for (int beat = 0; beat < mNBeats; ++beat) {
+    const int beatStart = beat * mNStepsPerBeat;
+    const int beatEnd = beatStart + mNStepsPerBeat;
+
+    for (int slice = 0; slice < mNSlices; ++slice) {
+      // with all other beats empty, the events of this beat are the ones it gets when nothing is carried into it
+      rp.setPatternId((PatternId)slice << beatStart);
+      const int nEvents = rp.asMusicalEvents(events, naturalDurations, false);
+
+      Tension * row = &mRows[((size_t)beat * mNSlices + slice) * mNStepsPerBeat];
+      Entry& entry = mEntries[(size_t)beat * mNSlices + slice];
+      const MusicalEvent* prevEvent = nullptr;
+      const MusicalEvent* firstEvent = nullptr;
+      const MusicalEvent* lastEvent = nullptr;
+
+      for (int eventIx = 0; eventIx < nEvents; ++eventIx) {
+        const MusicalEvent& event = events[eventIx];
+        if (event.position < beatStart || event.position >= beatEnd) {
+          prevEvent = &event;
+          continue;
+        }
+
+        const int salience = event.type == MusicalEventType::TIED_NOTE
+          ? prf[prevEvent->position]
+          : prf[event.position];
+
+        const Tension tension = salienceToTension(salience, salienceRange);
+        std::fill(row + (event.position - beatStart), row + (event.getTrailingPosition() - beatStart + 1), tension);
+
+        if (!firstEvent) firstEvent = &event;
+        lastEvent = &event;
+        prevEvent = &event;
+      }
+
+      assert(firstEvent && lastEvent);
+      entry.firstEventLength = firstEvent->type == MusicalEventType::REST ? firstEvent->duration : 0;
+      entry.carryOut = lastEvent->type == MusicalEventType::NOTE
+        ? salienceToTension(prf[lastEvent->position], salienceRange)
+        : MTV_BEAT_TABLE_NO_CARRY;
+      entry.wrapTension = salienceToTension(prf[lastEvent->position], salienceRange);
+      entry.wrapSounding = lastEvent->type != MusicalEventType::REST ? 1 : (lastEvent == firstEvent ? 2 : 0);
+    }
+  }
+
+  mValid = true;
+}
+
+void MTVBeatTable::computeMTV(PatternId patternId, Tension * mtvOut) const
+{
+  assert(mValid);
+
+  // the first beat is patched last, as its leading event depends on how the measure ends
+  const int firstSlice = getSlice(patternId, 0);
+  const Entry& firstEntry = getEntry(0, firstSlice);
+  const Tension * row = getRow(0, firstSlice);
+  std::copy(row, row + mNStepsPerBeat, mtvOut);
+
+  Tension carry = firstEntry.carryOut;
+  Tension carryIntoLastBeat = MTV_BEAT_TABLE_NO_CARRY;
+  const Entry* entry = &firstEntry;
+
+  for (int beat = 1; beat < mNBeats; ++beat) {
+    const int slice = getSlice(patternId, beat);
+    Tension * out = mtvOut + beat * mNStepsPerBeat;
+    entry = &getEntry(beat, slice);
+    row = getRow(beat, slice);
+    std::copy(row, row + mNStepsPerBeat, out);
+
+    // a leading rest becomes a tied note with the tension of the previous beat's last note
+    if (carry != MTV_BEAT_TABLE_NO_CARRY)
+      std::fill(out, out + entry->firstEventLength, carry);
+
+    carryIntoLastBeat = carry;
+    carry = entry->carryOut;
+  }
+
+  // cyclic: a leading rest becomes a tied note if the measure doesn't end with a rest
+  const bool lastEventSounds = entry->wrapSounding == 1
+    || (entry->wrapSounding == 2 && carryIntoLastBeat != MTV_BEAT_TABLE_NO_CARRY);
+
+  if (lastEventSounds)
+    std::fill(mtvOut, mtvOut + firstEntry.firstEventLength, entry->wrapTension);
+}
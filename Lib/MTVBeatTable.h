@@ -0,0 +1,79 @@
+#pragma once
+
+#include "Types.h"
+#include "TimeSignature.h"
+#include <vector>
+
+#define MTV_BEAT_TABLE_MAX_STEPS_PER_BEAT 12  // max beat length (in steps) for which tables are built
+#define MTV_BEAT_TABLE_NO_CARRY -1.0f  // carry value when the previous beat doesn't end with a note
+
+
+// converts a metrical salience to a tension, given the min-max values of the salience profile
+inline Tension salienceToTension(int salience, MetricalSalienceRange salienceRange)
+{
+  const MetricalSalience salienceDelta = salienceRange.second - salienceRange.first;
+  const double relSalience = (double)(salience - salienceRange.first) / salienceDelta;
+  return (Tension)(1.0 - relSalience);
+}
+
+
+// Per-beat tension lookup tables for one (time signature, step unit, salience profile) combination.
+// When durations are trimmed to the beat, the musical events of a pattern never cross a beat boundary,
+// so the tensions of a beat only depend on the onsets inside of it and on whether the previous beat
+// ended with a note (in which case a leading rest becomes a tied note). This table stores, for every
+// beat and every combination of onsets in that beat (slice), the tensions of the beat when nothing is
+// carried into it, together with what is needed to patch in the carry. MTVs are then built by
+// concatenating table rows instead of converting the pattern to musical events.
+class MTVBeatTable
+{
+public:
+  struct Entry
+  {
+    int firstEventLength;  // length of the leading event if it's a rest (0 if the beat starts with an onset)
+    Tension carryOut;      // tension of the last event if it's a note, MTV_BEAT_TABLE_NO_CARRY otherwise
+    Tension wrapTension;   // tension of the last event's own position (used to wrap the measure around)
+    int8_t wrapSounding;   // 1 if the last event sounds, 2 if it only sounds when carried into, 0 otherwise
+  };
+
+  MTVBeatTable(
+    const TimeSignature& ts,
+    UnitRef stepUnit,
+    const MetricalSalienceProfile& prf,
+    MetricalSalienceRange salienceRange
+  );
+
+  // returns whether the meter can be factorized per beat (if not, the table is empty)
+  inline bool isValid() const { return mValid; }
+
+  // computes the mtv of the given pattern (table must be valid)
+  void computeMTV(PatternId patternId, Tension * mtvOut) const;
+
+  inline int getNBeats() const { return mNBeats; }
+  inline int getNStepsPerBeat() const { return mNStepsPerBeat; }
+  inline int getNSlices() const { return mNSlices; }
+  // returns the memory used by the rows and entries (in bytes)
+  inline size_t getMemorySize() const { return mRows.capacity() * sizeof(Tension) + mEntries.capacity() * sizeof(Entry); }
+
+  // returns the onsets of the given beat in the given pattern
+  inline int getSlice(PatternId patternId, int beat) const {
+    return (int)((patternId >> (beat * mNStepsPerBeat)) & (PatternId)(mNSlices - 1));
+  }
+
+  // returns the tensions of the given beat/slice when nothing is carried into the beat
+  inline const Tension * getRow(int beat, int slice) const {
+    return &mRows[((size_t)beat * mNSlices + slice) * mNStepsPerBeat];
+  }
+
+  inline const Entry& getEntry(int beat, int slice) const {
+    return mEntries[(size_t)beat * mNSlices + slice];
+  }
+
+private:
+  bool mValid;
+  int mNSteps;
+  int mNBeats;
+  int mNStepsPerBeat;
+  int mNSlices;
+  std::vector<Tension> mRows;
+  std::vector<Entry> mEntries;
+};
@@ -0,0 +1,265 @@
+#include "MTVBlockKernel.h"
+#include <algorithm>
+#include <stdexcept>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define MTV_BLOCK_KERNEL_X86
+#include <immintrin.h>
+#endif
+
+// MSVC emits any intrinsic without flags, gcc and clang need the functions to be tagged
+#if defined(MTV_BLOCK_KERNEL_X86) && !defined(_MSC_VER)
+#define MTV_TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#define MTV_TARGET_AVX2
+#endif
+
+
+// raw view of the tables read by the vectorized kernel
+struct BlockTables
+{
+  const Tension * rows;
+  const int32_t * firstEventLengths;
+  const Tension * carryOuts;
+  const Tension * wrapTensions;
+  const int32_t * wrapSoundings;
+  int nBeats;
+  int nStepsPerBeat;
+  int nSlices;
+};
+
+
+#ifdef MTV_BLOCK_KERNEL_X86
+
+// returns the slice of each lane's pattern that starts at the given step
+MTV_TARGET_AVX2
+static inline __m256i getSlicesAvx2(__m256i idsLo, __m256i idsHi, int shift, int nStepsPerBeat, __m256i sliceMask)
+{
+  __m256i slices;
+  if (shift >= 32) {
+    slices = _mm256_srl_epi32(idsHi, _mm_cvtsi32_si128(shift - 32));
+  } else {
+    slices = _mm256_srl_epi32(idsLo, _mm_cvtsi32_si128(shift));
+    if (shift > 0 && shift + nStepsPerBeat > 32)
+      slices = _mm256_or_si256(slices, _mm256_sll_epi32(idsHi, _mm_cvtsi32_si128(32 - shift)));
+  }
+  return _mm256_and_si256(slices, sliceMask);
+}
+
+// writes 8 steps of the 8 lanes (one vector per step) to the 8 mtvs at mtvsOut
+MTV_TARGET_AVX2
+static inline void storeTransposed8x8(const Tension * lanes, Tension * mtvsOut, size_t nSteps)
+{
+  const __m256 r0 = _mm256_load_ps(lanes + 0 * MTV_BLOCK_KERNEL_N_LANES);
+  const __m256 r1 = _mm256_load_ps(lanes + 1 * MTV_BLOCK_KERNEL_N_LANES);
+  const __m256 r2 = _mm256_load_ps(lanes + 2 * MTV_BLOCK_KERNEL_N_LANES);
+  const __m256 r3 = _mm256_load_ps(lanes + 3 * MTV_BLOCK_KERNEL_N_LANES);
+  const __m256 r4 = _mm256_load_ps(lanes + 4 * MTV_BLOCK_KERNEL_N_LANES);
+  const __m256 r5 = _mm256_load_ps(lanes + 5 * MTV_BLOCK_KERNEL_N_LANES);
+  const __m256 r6 = _mm256_load_ps(lanes + 6 * MTV_BLOCK_KERNEL_N_LANES);
+  const __m256 r7 = _mm256_load_ps(lanes + 7 * MTV_BLOCK_KERNEL_N_LANES);
+
+  const __m256 t0 = _mm256_unpacklo_ps(r0, r1), t1 = _mm256_unpackhi_ps(r0, r1);
+  const __m256 t2 = _mm256_unpacklo_ps(r2, r3), t3 = _mm256_unpackhi_ps(r2, r3);
+  const __m256 t4 = _mm256_unpacklo_ps(r4, r5), t5 = _mm256_unpackhi_ps(r4, r5);
+  const __m256 t6 = _mm256_unpacklo_ps(r6, r7), t7 = _mm256_unpackhi_ps(r6, r7);
+
+  const __m256 u0 = _mm256_shuffle_ps(t0, t2, _MM_SHUFFLE(1, 0, 1, 0)), u1 = _mm256_shuffle_ps(t0, t2, _MM_SHUFFLE(3, 2, 3, 2));
+  const __m256 u2 = _mm256_shuffle_ps(t1, t3, _MM_SHUFFLE(1, 0, 1, 0)), u3 = _mm256_shuffle_ps(t1, t3, _MM_SHUFFLE(3, 2, 3, 2));
+  const __m256 u4 = _mm256_shuffle_ps(t4, t6, _MM_SHUFFLE(1, 0, 1, 0)), u5 = _mm256_shuffle_ps(t4, t6, _MM_SHUFFLE(3, 2, 3, 2));
+  const __m256 u6 = _mm256_shuffle_ps(t5, t7, _MM_SHUFFLE(1, 0, 1, 0)), u7 = _mm256_shuffle_ps(t5, t7, _MM_SHUFFLE(3, 2, 3, 2));
+
+  _mm256_storeu_ps(mtvsOut + 0 * nSteps, _mm256_permute2f128_ps(u0, u4, 0x20));
+  _mm256_storeu_ps(mtvsOut + 1 * nSteps, _mm256_permute2f128_ps(u1, u5, 0x20));
+  _mm256_storeu_ps(mtvsOut + 2 * nSteps, _mm256_permute2f128_ps(u2, u6, 0x20));
+  _mm256_storeu_ps(mtvsOut + 3 * nSteps, _mm256_permute2f128_ps(u3, u7, 0x20));
+  _mm256_storeu_ps(mtvsOut + 4 * nSteps, _mm256_permute2f128_ps(u0, u4, 0x31));
+  _mm256_storeu_ps(mtvsOut + 5 * nSteps, _mm256_permute2f128_ps(u1, u5, 0x31));
+  _mm256_storeu_ps(mtvsOut + 6 * nSteps, _mm256_permute2f128_ps(u2, u6, 0x31));
+  _mm256_storeu_ps(mtvsOut + 7 * nSteps, _mm256_permute2f128_ps(u3, u7, 0x31));
+}
+
+// writes 4 steps of the 8 lanes (one vector per step) to the 8 mtvs at mtvsOut
+MTV_TARGET_AVX2
+static inline void storeTransposed4x8(const Tension * lanes, Tension * mtvsOut, size_t nSteps)
+{
+  for (int half = 0; half < 2; ++half) {
+    const int lane0 = half * 4;
+    __m128 r0 = _mm_load_ps(lanes + 0 * MTV_BLOCK_KERNEL_N_LANES + lane0);
+    __m128 r1 = _mm_load_ps(lanes + 1 * MTV_BLOCK_KERNEL_N_LANES + lane0);
+    __m128 r2 = _mm_load_ps(lanes + 2 * MTV_BLOCK_KERNEL_N_LANES + lane0);
+    __m128 r3 = _mm_load_ps(lanes + 3 * MTV_BLOCK_KERNEL_N_LANES + lane0);
+    _MM_TRANSPOSE4_PS(r0, r1, r2, r3);
+    _mm_storeu_ps(mtvsOut + (lane0 + 0) * nSteps, r0);
+    _mm_storeu_ps(mtvsOut + (lane0 + 1) * nSteps, r1);
+    _mm_storeu_ps(mtvsOut + (lane0 + 2) * nSteps, r2);
+    _mm_storeu_ps(mtvsOut + (lane0 + 3) * nSteps, r3);
+  }
+}
+
+// Computes the mtvs of MTV_BLOCK_KERNEL_N_LANES patterns, same steps as MTVBeatTable::computeMTV. Patterns of
+// a block usually differ in their low bits only, so the beats whose slice is the same in all lanes broadcast
+// their row instead of gathering it.
+MTV_TARGET_AVX2
+static void computeLanesAvx2(const BlockTables& tables, const PatternId * patternIds, Tension * mtvsOut)
+{
+  const int nStepsPerBeat = tables.nStepsPerBeat;
+  const int nSteps = tables.nBeats * nStepsPerBeat;
+
+  // 64 bits pattern ids are split in two 32 bits halves
+  alignas(32) int32_t idsLo[MTV_BLOCK_KERNEL_N_LANES], idsHi[MTV_BLOCK_KERNEL_N_LANES];
+  for (int lane = 0; lane < MTV_BLOCK_KERNEL_N_LANES; ++lane) {
+    idsLo[lane] = (int32_t)(uint32_t)patternIds[lane];
+    idsHi[lane] = (int32_t)(uint32_t)(patternIds[lane] >> 32);
+  }
+
+  const __m256i vIdsLo = _mm256_load_si256((const __m256i *)idsLo);
+  const __m256i vIdsHi = _mm256_load_si256((const __m256i *)idsHi);
+  const __m256i sliceMask = _mm256_set1_epi32(tables.nSlices - 1);
+  const __m256 noCarry = _mm256_set1_ps(MTV_BEAT_TABLE_NO_CARRY);
+
+  // tensions per [step][lane], transposed into the output at the end
+  alignas(32) Tension lanes[MAX_N_STEPS * MTV_BLOCK_KERNEL_N_LANES];
+
+  __m256 carry = noCarry;
+  __m256 carryIntoLastBeat = noCarry;
+  __m256i firstEventLengths = _mm256_setzero_si256();
+  __m256i entryIx = _mm256_setzero_si256();
+
+  for (int beat = 0; beat < tables.nBeats; ++beat) {
+    const __m256i slices = getSlicesAvx2(vIdsLo, vIdsHi, beat * nStepsPerBeat, nStepsPerBeat, sliceMask);
+    const int firstLaneSlice = _mm256_cvtsi256_si32(slices);
+    const bool uniform = _mm256_movemask_epi8(_mm256_cmpeq_epi32(slices, _mm256_set1_epi32(firstLaneSlice))) == -1;
+    entryIx = _mm256_add_epi32(_mm256_set1_epi32(beat * tables.nSlices), slices);
+
+    const __m256i eventLengths = uniform
+      ? _mm256_set1_epi32(tables.firstEventLengths[beat * tables.nSlices + firstLaneSlice])
+      : _mm256_i32gather_epi32(tables.firstEventLengths, entryIx, 4);
+    const __m256i carried = _mm256_castps_si256(_mm256_cmp_ps(carry, noCarry, _CMP_NEQ_OQ));
+    Tension * beatLanes = lanes + beat * nStepsPerBeat * MTV_BLOCK_KERNEL_N_LANES;
+
+    if (uniform) {
+      const Tension * const row = tables.rows + ((size_t)beat * tables.nSlices + firstLaneSlice) * nStepsPerBeat;
+      for (int pos = 0; pos < nStepsPerBeat; ++pos)
+        _mm256_store_ps(beatLanes + pos * MTV_BLOCK_KERNEL_N_LANES, _mm256_broadcast_ss(row + pos));
+    } else {
+      const __m256i rowIx = _mm256_mullo_epi32(entryIx, _mm256_set1_epi32(nStepsPerBeat));
+      for (int pos = 0; pos < nStepsPerBeat; ++pos) {
+        const __m256 row = _mm256_i32gather_ps(tables.rows, _mm256_add_epi32(rowIx, _mm256_set1_epi32(pos)), 4);
+        _mm256_store_ps(beatLanes + pos * MTV_BLOCK_KERNEL_N_LANES, row);
+      }
+    }
+
+    // a leading rest becomes a tied note with the tension of the previous beat's last note
+    if (!_mm256_testz_si256(carried, _mm256_cmpgt_epi32(eventLengths, _mm256_setzero_si256()))) {
+      for (int pos = 0; pos < nStepsPerBeat; ++pos) {
+        Tension * const stepLanes = beatLanes + pos * MTV_BLOCK_KERNEL_N_LANES;
+        const __m256i tied = _mm256_and_si256(carried, _mm256_cmpgt_epi32(eventLengths, _mm256_set1_epi32(pos)));
+        _mm256_store_ps(stepLanes, _mm256_blendv_ps(_mm256_load_ps(stepLanes), carry, _mm256_castsi256_ps(tied)));
+      }
+    }
+
+    if (beat == 0)
+      firstEventLengths = eventLengths;
+
+    carryIntoLastBeat = carry;
+    carry = uniform
+      ? _mm256_set1_ps(tables.carryOuts[beat * tables.nSlices + firstLaneSlice])
+      : _mm256_i32gather_ps(tables.carryOuts, entryIx, 4);
+  }
+
+  // cyclic: a leading rest becomes a tied note if the measure doesn't end with a rest
+  const __m256i wrapSounding = _mm256_i32gather_epi32(tables.wrapSoundings, entryIx, 4);
+  const __m256 wrapTensions = _mm256_i32gather_ps(tables.wrapTensions, entryIx, 4);
+  const __m256i lastEventSounds = _mm256_or_si256(
+    _mm256_cmpeq_epi32(wrapSounding, _mm256_set1_epi32(1)),
+    _mm256_and_si256(
+      _mm256_cmpeq_epi32(wrapSounding, _mm256_set1_epi32(2)),
+      _mm256_castps_si256(_mm256_cmp_ps(carryIntoLastBeat, noCarry, _CMP_NEQ_OQ))));
+
+  for (int pos = 0; pos < nStepsPerBeat; ++pos) {
+    Tension * const stepLanes = lanes + pos * MTV_BLOCK_KERNEL_N_LANES;
+    const __m256i wrapped = _mm256_and_si256(lastEventSounds, _mm256_cmpgt_epi32(firstEventLengths, _mm256_set1_epi32(pos)));
+    _mm256_store_ps(stepLanes, _mm256_blendv_ps(_mm256_load_ps(stepLanes), wrapTensions, _mm256_castsi256_ps(wrapped)));
+  }
+
+  // transpose the lanes into the output, 8 and then 4 steps at a time
+  int step = 0;
+  for (; step + 8 <= nSteps; step += 8)
+    storeTransposed8x8(lanes + step * MTV_BLOCK_KERNEL_N_LANES, mtvsOut + step, nSteps);
+  for (; step + 4 <= nSteps; step += 4)
+    storeTransposed4x8(lanes + step * MTV_BLOCK_KERNEL_N_LANES, mtvsOut + step, nSteps);
+
+  for (; step < nSteps; ++step) {
+    for (int lane = 0; lane < MTV_BLOCK_KERNEL_N_LANES; ++lane)
+      mtvsOut[(size_t)lane * nSteps + step] = lanes[step * MTV_BLOCK_KERNEL_N_LANES + lane];
+  }
+}
+
+#endif  // MTV_BLOCK_KERNEL_X86
+
+
+MTVBlockKernel::MTVBlockKernel(const MTVBeatTable& table, SimdLevel simdLevel) :
+  mTable(table),
+  mSimdLevel(simdLevel)
+{
+  if (!table.isValid())
+    throw std::runtime_error("MTVBlockKernel requires a valid beat table");
+
+  const size_t nEntries = (size_t)table.getNBeats() * table.getNSlices();
+  mFirstEventLengths.reserve(nEntries);
+  mCarryOuts.reserve(nEntries);
+  mWrapTensions.reserve(nEntries);
+  mWrapSoundings.reserve(nEntries);
+
+  for (int beat = 0; beat < table.getNBeats(); ++beat) {
+    for (int slice = 0; slice < table.getNSlices(); ++slice) {
+      const MTVBeatTable::Entry& entry = table.getEntry(beat, slice);
+      mFirstEventLengths.push_back(entry.firstEventLength);
+      mCarryOuts.push_back(entry.carryOut);
+      mWrapTensions.push_back(entry.wrapTension);
+      mWrapSoundings.push_back(entry.wrapSounding);
+    }
+  }
+}
+
+size_t MTVBlockKernel::getMemorySize() const
+{
+  return mFirstEventLengths.capacity() * sizeof(int32_t) + mCarryOuts.capacity() * sizeof(Tension)
+    + mWrapTensions.capacity() * sizeof(Tension) + mWrapSoundings.capacity() * sizeof(int32_t);
+}
+
+void MTVBlockKernel::computeMTVRange(PatternId begin, size_t count, Tension * mtvsOut) const
+{
+  PatternId patternIds[MTV_BLOCK_KERNEL_N_LANES];
+  const size_t nSteps = (size_t)mTable.getNBeats() * mTable.getNStepsPerBeat();
+
+  for (size_t i = 0; i < count; i += MTV_BLOCK_KERNEL_N_LANES) {
+    const size_t nLanes = std::min(count - i, (size_t)MTV_BLOCK_KERNEL_N_LANES);
+    for (size_t lane = 0; lane < nLanes; ++lane)
+      patternIds[lane] = begin + i + lane;
+    computeMTVs(patternIds, nLanes, mtvsOut + i * nSteps);
+  }
+}
+
+void MTVBlockKernel::computeMTVs(const PatternId * patternIds, size_t count, Tension * mtvsOut) const
+{
+  const size_t nSteps = (size_t)mTable.getNBeats() * mTable.getNStepsPerBeat();
+  size_t i = 0;
+
+#ifdef MTV_BLOCK_KERNEL_X86
+  if (mSimdLevel >= SimdLevel::AVX2) {
+    const BlockTables tables = {
+      mTable.getRow(0, 0), mFirstEventLengths.data(), mCarryOuts.data(), mWrapTensions.data(), mWrapSoundings.data(),
+      mTable.getNBeats(), mTable.getNStepsPerBeat(), mTable.getNSlices()
+    };
+
+    for (; i + MTV_BLOCK_KERNEL_N_LANES <= count; i += MTV_BLOCK_KERNEL_N_LANES)
+      computeLanesAvx2(tables, patternIds + i, mtvsOut + i * nSteps);
+  }
+#endif
+
+  // scalar kernel, and the lanes left over by the vectorized one
+  for (; i < count; ++i)
+    mTable.computeMTV(patternIds[i], mtvsOut + i * nSteps);
+}
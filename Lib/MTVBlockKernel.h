@@ -0,0 +1,40 @@
+#pragma once
+
+#include "Types.h"
+#include "MTVBeatTable.h"
+#include "MTVDistanceKernel.h"
+#include <vector>
+
+#define MTV_BLOCK_KERNEL_N_LANES 8  // patterns computed in parallel by the vectorized kernel
+
+
+// Computes the mtvs of many patterns per call from a MTVBeatTable. The vectorized kernel runs one pattern
+// per lane: the slice of each beat is extracted from the lane's pattern id with shifts and masks, the rows
+// and entries of the table are gathered per lane, and the carried and wrapped tensions are blended in with
+// lane masks, so that no lane branches. The scalar kernel (and the tail of a block) uses
+// MTVBeatTable::computeMTV, which gives the same results.
+class MTVBlockKernel
+{
+public:
+  // the table must be valid and outlive the kernel. The given instruction set must be supported by this
+  // cpu (AVX2 gathers are required for the vectorized kernel, lower levels fall back to the scalar one).
+  explicit MTVBlockKernel(const MTVBeatTable& table, SimdLevel simdLevel = getSupportedSimdLevel());
+
+  // computes the mtvs of patterns [begin, begin + count) and writes them one after the other (row-major)
+  void computeMTVRange(PatternId begin, size_t count, Tension * mtvsOut) const;
+  // same as above, for count arbitrary patterns (with the vectorized kernel, blocks of lanes are computed at once)
+  void computeMTVs(const PatternId * patternIds, size_t count, Tension * mtvsOut) const;
+
+  inline const MTVBeatTable& getBeatTable() const { return mTable; }
+  inline SimdLevel getSimdLevel() const { return mSimdLevel; }
+  size_t getMemorySize() const;  // returns the memory used by the split entries (in bytes), without the table
+
+private:
+  const MTVBeatTable& mTable;
+  const SimdLevel mSimdLevel;
+  // the entries of the table split per field (see MTVBeatTable::Entry), so that they can be gathered
+  std::vector<int32_t> mFirstEventLengths;
+  std::vector<Tension> mCarryOuts;
+  std::vector<Tension> mWrapTensions;
+  std::vector<int32_t> mWrapSoundings;
+};
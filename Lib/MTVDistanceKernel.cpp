@@ -0,0 +1,302 @@
+#include "MTVDistanceKernel.h"
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define MTV_DISTANCE_KERNEL_X86
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#endif
+
+// MSVC emits any intrinsic without flags, gcc and clang need the functions to be tagged
+#if defined(MTV_DISTANCE_KERNEL_X86) && !defined(_MSC_VER)
+#define MTV_TARGET_SSE __attribute__((target("sse2")))
+#define MTV_TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#define MTV_TARGET_SSE
+#define MTV_TARGET_AVX2
+#endif
+
+
+static SimdLevel detectSimdLevel()
+{
+#if !defined(MTV_DISTANCE_KERNEL_X86)
+  return SimdLevel::SCALAR;
+#elif defined(_MSC_VER)
+  int info[4];
+  __cpuid(info, 0);
+  const int nIds = info[0];
+
+  __cpuid(info, 1);
+  const bool sse2 = (info[3] & (1 << 26)) != 0;
+  const bool osxsave = (info[2] & (1 << 27)) != 0;
+  const bool avx = (info[2] & (1 << 28)) != 0;
+  bool avx2 = false;
+
+  if (nIds >= 7 && osxsave && avx && (_xgetbv(0) & 0x6) == 0x6) {
+    __cpuidex(info, 7, 0);
+    avx2 = (info[1] & (1 << 5)) != 0;
+  }
+
+  return avx2 ? SimdLevel::AVX2 : (sse2 ? SimdLevel::SSE : SimdLevel::SCALAR);
+#else
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2")) return SimdLevel::AVX2;
+  if (__builtin_cpu_supports("sse2")) return SimdLevel::SSE;
+  return SimdLevel::SCALAR;
+#endif
+}
+
+SimdLevel getSupportedSimdLevel()
+{
+  static const SimdLevel level = detectSimdLevel();
+  return level;
+}
+
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// scalar
+
+template <int NDims>
+static void squaredDistancesScalar(const Tension * const target, const Tension * points,
+  size_t count, int nDimsArg, float * out)
+{
+  const int nDims = NDims ? NDims : nDimsArg;  // NDims is 0 for the generic kernel
+  for (size_t i = 0; i < count; ++i, points += nDims) {
+    int32_t units = 0;
+    for (int pos = 0; pos < nDims; ++pos)
+      units += getSquaredDiffUnits(target[pos], points[pos]);
+    out[i] = unitsToSquaredDistance(units);
+  }
+}
+
+template <int NDims>
+static void squaredDistancesColumnMajorScalar(const Tension * const target, const Tension * columns,
+  size_t columnStride, size_t begin, size_t count, int nDimsArg, float * out)
+{
+  const int nDims = NDims ? NDims : nDimsArg;
+  for (size_t i = 0; i < count; ++i) {
+    const Tension * column = columns + begin + i;
+    int32_t units = 0;
+    for (int pos = 0; pos < nDims; ++pos, column += columnStride)
+      units += getSquaredDiffUnits(target[pos], *column);
+    out[i] = unitsToSquaredDistance(units);
+  }
+}
+
+
+#ifdef MTV_DISTANCE_KERNEL_X86
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// sse
+
+// squared differences in units, rounded like getSquaredDiffUnits (to nearest, the default rounding mode)
+MTV_TARGET_SSE
+static inline __m128i squaredDiffUnits(__m128 a, __m128 b)
+{
+  const __m128 delta = _mm_sub_ps(a, b);
+  return _mm_cvtps_epi32(_mm_mul_ps(_mm_mul_ps(delta, delta), _mm_set1_ps(MTV_DISTANCE_UNITS)));
+}
+
+MTV_TARGET_SSE
+static inline int32_t horizontalSum(__m128i v)
+{
+  v = _mm_add_epi32(v, _mm_shuffle_epi32(v, _MM_SHUFFLE(1, 0, 3, 2)));
+  v = _mm_add_epi32(v, _mm_shuffle_epi32(v, _MM_SHUFFLE(2, 3, 0, 1)));
+  return _mm_cvtsi128_si32(v);
+}
+
+template <int NDims>
+MTV_TARGET_SSE
+static void squaredDistancesSse(const Tension * const target, const Tension * points,
+  size_t count, int nDimsArg, float * out)
+{
+  const int nDims = NDims ? NDims : nDimsArg;
+  const int nVecDims = nDims & ~3;
+
+  for (size_t i = 0; i < count; ++i, points += nDims) {
+    __m128i acc = _mm_setzero_si128();
+    int pos = 0;
+
+    for (; pos < nVecDims; pos += 4)
+      acc = _mm_add_epi32(acc, squaredDiffUnits(_mm_loadu_ps(target + pos), _mm_loadu_ps(points + pos)));
+
+    int32_t units = horizontalSum(acc);
+    for (; pos < nDims; ++pos)
+      units += getSquaredDiffUnits(target[pos], points[pos]);
+
+    out[i] = unitsToSquaredDistance(units);
+  }
+}
+
+template <int NDims>
+MTV_TARGET_SSE
+static void squaredDistancesColumnMajorSse(const Tension * const target, const Tension * columns,
+  size_t columnStride, size_t begin, size_t count, int nDimsArg, float * out)
+{
+  const int nDims = NDims ? NDims : nDimsArg;
+  const size_t nVecPoints = count & ~(size_t)3;
+  const __m128 unit = _mm_set1_ps(1.0f / MTV_DISTANCE_UNITS);
+  size_t i = 0;
+
+  for (; i < nVecPoints; i += 4) {
+    __m128i acc = _mm_setzero_si128();
+    const Tension * column = columns + begin + i;
+
+    for (int pos = 0; pos < nDims; ++pos, column += columnStride)
+      acc = _mm_add_epi32(acc, squaredDiffUnits(_mm_set1_ps(target[pos]), _mm_loadu_ps(column)));
+
+    _mm_storeu_ps(out + i, _mm_mul_ps(_mm_cvtepi32_ps(acc), unit));
+  }
+
+  squaredDistancesColumnMajorScalar<NDims>(target, columns, columnStride, begin + i, count - i, nDims, out + i);
+}
+
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// avx2
+
+MTV_TARGET_AVX2
+static inline __m256i squaredDiffUnits(__m256 a, __m256 b)
+{
+  const __m256 delta = _mm256_sub_ps(a, b);
+  return _mm256_cvtps_epi32(_mm256_mul_ps(_mm256_mul_ps(delta, delta), _mm256_set1_ps(MTV_DISTANCE_UNITS)));
+}
+
+template <int NDims>
+MTV_TARGET_AVX2
+static void squaredDistancesAvx2(const Tension * const target, const Tension * points,
+  size_t count, int nDimsArg, float * out)
+{
+  const int nDims = NDims ? NDims : nDimsArg;
+  const int nVecDims = nDims & ~7;
+  const int nHalfVecDims = nDims & ~3;
+
+  for (size_t i = 0; i < count; ++i, points += nDims) {
+    __m256i acc = _mm256_setzero_si256();
+    int pos = 0;
+
+    for (; pos < nVecDims; pos += 8)
+      acc = _mm256_add_epi32(acc, squaredDiffUnits(_mm256_loadu_ps(target + pos), _mm256_loadu_ps(points + pos)));
+
+    __m128i acc128 = _mm_add_epi32(_mm256_castsi256_si128(acc), _mm256_extracti128_si256(acc, 1));
+
+    for (; pos < nHalfVecDims; pos += 4)
+      acc128 = _mm_add_epi32(acc128, squaredDiffUnits(_mm_loadu_ps(target + pos), _mm_loadu_ps(points + pos)));
+
+    int32_t units = horizontalSum(acc128);
+    for (; pos < nDims; ++pos)
+      units += getSquaredDiffUnits(target[pos], points[pos]);
+
+    out[i] = unitsToSquaredDistance(units);
+  }
+}
+
+template <int NDims>
+MTV_TARGET_AVX2
+static void squaredDistancesColumnMajorAvx2(const Tension * const target, const Tension * columns,
+  size_t columnStride, size_t begin, size_t count, int nDimsArg, float * out)
+{
+  const int nDims = NDims ? NDims : nDimsArg;
+  const size_t nVecPoints = count & ~(size_t)7;
+  const __m256 unit = _mm256_set1_ps(1.0f / MTV_DISTANCE_UNITS);
+  size_t i = 0;
+
+  for (; i < nVecPoints; i += 8) {
+    __m256i acc = _mm256_setzero_si256();
+    const Tension * column = columns + begin + i;
+
+    for (int pos = 0; pos < nDims; ++pos, column += columnStride)
+      acc = _mm256_add_epi32(acc, squaredDiffUnits(_mm256_set1_ps(target[pos]), _mm256_loadu_ps(column)));
+
+    _mm256_storeu_ps(out + i, _mm256_mul_ps(_mm256_cvtepi32_ps(acc), unit));
+  }
+
+  squaredDistancesColumnMajorSse<NDims>(target, columns, columnStride, begin + i, count - i, nDims, out + i);
+}
+
+#endif  // MTV_DISTANCE_KERNEL_X86
+
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// dispatch
+
+template <int NDims>
+static void squaredDistances(const Tension * const target, const Tension * points, size_t count, int nDims, 
+  float * squaredDistancesOut, SimdLevel simdLevel)
+{
+  switch (simdLevel) {
+#ifdef MTV_DISTANCE_KERNEL_X86
+  case SimdLevel::AVX2:
+    squaredDistancesAvx2<NDims>(target, points, count, nDims, squaredDistancesOut);
+    break;
+  case SimdLevel::SSE:
+    squaredDistancesSse<NDims>(target, points, count, nDims, squaredDistancesOut);
+    break;
+#endif
+  default:
+    squaredDistancesScalar<NDims>(target, points, count, nDims, squaredDistancesOut);
+  }
+}
+
+template <int NDims>
+static void squaredDistancesColumnMajor(const Tension * const target, const Tension * columns, size_t columnStride, 
+  size_t begin, size_t count, int nDims, float * squaredDistancesOut, SimdLevel simdLevel)
+{
+  switch (simdLevel) {
+#ifdef MTV_DISTANCE_KERNEL_X86
+  case SimdLevel::AVX2:
+    squaredDistancesColumnMajorAvx2<NDims>(target, columns, columnStride, begin, count, nDims, squaredDistancesOut);
+    break;
+  case SimdLevel::SSE:
+    squaredDistancesColumnMajorSse<NDims>(target, columns, columnStride, begin, count, nDims, squaredDistancesOut);
+    break;
+#endif
+  default:
+    squaredDistancesColumnMajorScalar<NDims>(target, columns, columnStride, begin, count, nDims, squaredDistancesOut);
+  }
+}
+
+// the step counts of the standard meters (see MTVStaticMeter.h) get kernels with unrolled dimension loops, 
+// (all kernels sum whole units, so they give the same results whatever the order of the additions)
+void computeSquaredDistances(
+  const Tension * const target,
+  const Tension * points,
+  size_t count,
+  int nDims,
+  float * squaredDistancesOut,
+  SimdLevel simdLevel
+)
+{
+  switch (nDims) {
+  case 3: squaredDistances<3>(target, points, count, nDims, squaredDistancesOut, simdLevel); break;
+  case 4: squaredDistances<4>(target, points, count, nDims, squaredDistancesOut, simdLevel); break;
+  case 6: squaredDistances<6>(target, points, count, nDims, squaredDistancesOut, simdLevel); break;
+  case 8: squaredDistances<8>(target, points, count, nDims, squaredDistancesOut, simdLevel); break;
+  case 12: squaredDistances<12>(target, points, count, nDims, squaredDistancesOut, simdLevel); break;
+  case 16: squaredDistances<16>(target, points, count, nDims, squaredDistancesOut, simdLevel); break;
+  default: squaredDistances<0>(target, points, count, nDims, squaredDistancesOut, simdLevel);
+  }
+}
+
+void computeSquaredDistancesColumnMajor(
+  const Tension * const target,
+  const Tension * columns,
+  size_t columnStride,
+  size_t begin,
+  size_t count,
+  int nDims,
+  float * squaredDistancesOut,
+  SimdLevel simdLevel
+)
+{
+  switch (nDims) {
+  case 3: squaredDistancesColumnMajor<3>(target, columns, columnStride, begin, count, nDims, squaredDistancesOut, simdLevel); break;
+  case 4: squaredDistancesColumnMajor<4>(target, columns, columnStride, begin, count, nDims, squaredDistancesOut, simdLevel); break;
+  case 6: squaredDistancesColumnMajor<6>(target, columns, columnStride, begin, count, nDims, squaredDistancesOut, simdLevel); break;
+  case 8: squaredDistancesColumnMajor<8>(target, columns, columnStride, begin, count, nDims, squaredDistancesOut, simdLevel); break;
+  case 12: squaredDistancesColumnMajor<12>(target, columns, columnStride, begin, count, nDims, squaredDistancesOut, simdLevel); break;
+  case 16: squaredDistancesColumnMajor<16>(target, columns, columnStride, begin, count, nDims, squaredDistancesOut, simdLevel); break;
+  default: squaredDistancesColumnMajor<0>(target, columns, columnStride, begin, count, nDims, squaredDistancesOut, simdLevel);
+  }
+}
@@ -0,0 +1,59 @@
+#pragma once
+
+#include "Types.h"
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+
+// Squared distances are counted in units of 1 / MTV_DISTANCE_UNITS: every squared tension difference is
+// rounded to a whole number of units before it's added, so that the sums are exact integers. They don't
+// depend on the summation order, the instruction set or FMA contraction, and patterns at the same
+// distance always get the same value. Sums of up to 32 differences in [0, 1] are also exact as floats.
+#define MTV_DISTANCE_UNITS 524288.0f  // 2^19
+
+// instruction set used by the distance kernels
+enum SimdLevel {
+  SCALAR = 0,
+  SSE = 1,
+  AVX2 = 2
+};
+
+// returns the squared difference of two tensions as a whole number of units (same rounding as the kernels)
+inline int32_t getSquaredDiffUnits(Tension a, Tension b) {
+  const float delta = a - b;
+  return (int32_t)std::lrint(delta * delta * MTV_DISTANCE_UNITS);
+}
+
+// converts a sum of units to a squared distance (exact below 2^24 units)
+inline float unitsToSquaredDistance(int32_t units) {
+  return (float)units * (1.0f / MTV_DISTANCE_UNITS);
+}
+
+// returns the best instruction set supported by this cpu (detected once, at first call)
+SimdLevel getSupportedSimdLevel();
+
+// Computes the squared (not normalized) distances from the target mtv to count row-major mtvs of nDims
+// tensions each, stored one after the other at points. Writes count values to squaredDistancesOut. The
+// kernel for the given instruction set is used, which must be supported by this cpu. All kernels give the
+// same values as summing getSquaredDiffUnits over the dimensions.
+void computeSquaredDistances(
+  const Tension * const target,
+  const Tension * points,
+  size_t count,
+  int nDims,
+  float * squaredDistancesOut,
+  SimdLevel simdLevel = getSupportedSimdLevel()
+);
+
+// Same as computeSquaredDistances, but for column-major mtvs, where the tension of point i at step s
+// is stored at columns[s * columnStride + i]. Points [begin, begin + count) are computed.
+void computeSquaredDistancesColumnMajor(
+  const Tension * const target,
+  const Tension * columns,
+  size_t columnStride,
+  size_t begin,
+  size_t count,
+  int nDims,
+  float * squaredDistancesOut,
+  SimdLevel simdLevel = getSupportedSimdLevel()
+);
@@ -1,78 +1,448 @@
 #include "MTVRhythmSpace.h"
+#include "Utils.h"
 #include <exception>
 #include <algorithm>
 #include <cmath>
 #include <limits>
+#include <atomic>
+#include <thread>
+#include <chrono>
+#include <fstream>
+#include <cstring>
+#include <cstdio>
+#include <unordered_map>
 
 
-MTVRhythmSpace::MTVRhythmSpace(const TimeSignature& ts, UnitRef stepUnit) : 
+static std::atomic<uint64_t> sNextSpaceId(1);
+
+// Header of a space file. It's followed by the salience profile (one int8 per step), padding up to 
+// dataOffset (a multiple of MTV_RHYTHM_SPACE_POINT_ALIGNMENT) and the point buffer.
+struct SpaceFileHeader
+{
+  char magic[4];
+  uint32_t version;
+  uint32_t byteOrderMark;
+  int32_t numerator;
+  int32_t denominator;
+  int32_t stepUnitNumerator;
+  int32_t stepUnitDenominator;
+  int32_t rootSalience;
+  int32_t layout;
+  int32_t format;
+  int32_t nSteps;
+  int32_t reserved;
+  uint64_t nPoints;
+  uint64_t dataOffset;
+  uint64_t dataSize;
+};
+
+static const char SPACE_FILE_MAGIC[4] = { 'M', 'T', 'V', 'S' };
+static const uint32_t SPACE_FILE_BYTE_ORDER_MARK = 0x01020304;
+
+MTVRhythmSpace::MTVRhythmSpace(const TimeSignature& ts, UnitRef stepUnit, PointLayout layout, 
+  QueryBackend backend, PointFormat format) : 
+  mId(sNextSpaceId++),
   mReady(false),
   mTs(ts),
   mStepUnit(stepUnit),
+  mLayout(layout),
+  mBackend(backend),
+  mFormat(format),
   mNSteps(ts.getExactMeasureDuration(stepUnit)),
-  mNPoints((int)std::pow(2.f, mNSteps))
+  mNPoints(mNSteps < MAX_N_STEPS ? (PatternId)1 << mNSteps : std::numeric_limits<PatternId>::max()),
+  mPoints(nullptr),
+  mLevels(nullptr),
+  mStaticMTVKernel(nullptr),
+  mIndexEnabled(false)
 {
   ts.checkStepUnit(stepUnit);
-  mPoints.reserve(mNPoints);
-  mDistanceCache.reserve(mNPoints);
-  mDistanceCacheTargetPoint = new Tension[mNSteps];  
+
+  if (mNSteps > MAX_N_STEPS) {
+    char msg[70];
+    sprintf_s(msg, "n steps %d exceeds maximum of %d", mNSteps, MAX_N_STEPS);
+    throw std::runtime_error(msg);
+  }
 }
 
 MTVRhythmSpace::~MTVRhythmSpace()
 {
-  auto pointIt = mPoints.begin();
-
-  while (pointIt != mPoints.end()) {
-    const Tension* const mtv = *pointIt;
-    delete[] mtv;
-    pointIt = mPoints.erase(pointIt);
+  // mapped points are released with the mapping
+  if (!mMappedFile) {
+    alignedFree(mPoints);
+    alignedFree(mLevels);
   }
-  
-  delete[] mDistanceCacheTargetPoint;
 }
 
-void MTVRhythmSpace::fill(std::function<void(double)> progressFuncCallback)
+void MTVRhythmSpace::setupSalience(MetricalSalienceProfile& prf, MetricalSalienceRange& prfRange)
 {
-  if (mReady) return;
-  assert(mPoints.empty());
-
   // get metrical salience profile and find the minimum salience
-  std::pair<MetricalSalience, MetricalSalience> prfRange;
-  prfRange.second = 0;  // <- use use this as root, making this the max salience
-  const MetricalSalienceProfile prf = mTs.getMetricalSalienceProfile(mStepUnit, prfRange.second);
+  prfRange.second = MTV_RHYTHM_SPACE_ROOT_SALIENCE;  // <- use use this as root, making this the max salience
+  mMeterTables = MeterTables::get(mTs, mStepUnit);
+  prf = mMeterTables->getMetricalSalienceProfile(prfRange.second);
   prfRange.first = *std::min_element(prf.begin(), prf.begin() + mNSteps);
 
-  // create one rhythm pattern object and reuse it to compute MTVs for all combinations
-  RhythmPattern rp(mTs, mStepUnit);
-  
-  // compute tension vectors for all possible rhythm patterns (with this 
-  // space's time signature and step unit)
-  for (PatternId patternId = 0; patternId < mNPoints; ++patternId) {
-    assert(patternId == mPoints.size());
-    rp.setPatternId(patternId);
-    Tension* mtv = new Tension[mNSteps];
-    computeMTV(rp, prf, prfRange, mtv);
-    mPoints.push_back(mtv);
-    if (progressFuncCallback)
-      progressFuncCallback(((double)patternId + 1.0) / mNPoints);
+  // tensions only take one value per salience level
+  const int salienceDelta = prfRange.second - prfRange.first;
+  mLevelTensions.resize(salienceDelta + 1);
+  for (int level = 0; level <= salienceDelta; ++level)
+    mLevelTensions[level] = salienceToTension(prfRange.second - level, prfRange);
+
+  // precompute the per-beat tension tables, so that mtvs can be built without musical events
+  mBlockKernel.reset();
+  mBeatTable.reset(new MTVBeatTable(mTs, mStepUnit, prf, prfRange));
+  mStaticMTVKernel = getStaticMTVKernel(mTs, mStepUnit);
+
+  // without gathers, the block kernel is no faster than computing the mtvs one by one
+  if (mBeatTable->isValid() && getSupportedSimdLevel() >= SimdLevel::AVX2)
+    mBlockKernel.reset(new MTVBlockKernel(*mBeatTable));
+}
+
+bool MTVRhythmSpace::fill(std::function<void(double)> progressFuncCallback, int nThreads, 
+  const CancellationToken * cancellationToken)
+{
+  if (mReady) return true;
+  assert(!mPoints && !mLevels);
+
+  MetricalSalienceProfile prf;
+  MetricalSalienceRange prfRange;
+  setupSalience(prf, prfRange);
+
+  // an implicit space is searched through the beat tables, there's nothing else to compute
+  if (mBackend == QueryBackend::IMPLICIT) {
+    if (!mBeatTable->isValid()) {
+      char msg[100];
+      sprintf_s(msg, "%d/%d meter can't be factorized per beat (required by the implicit backend)", 
+        mTs.getNumerator(), mTs.getDenominator());
+      throw std::runtime_error(msg);
+    }
+
+    mBeatSearch.reset(new MTVBeatSearch(*mBeatTable));
+    if (progressFuncCallback) progressFuncCallback(1.0);
+    mReady = true;
+    return true;
+  }
+
+  if (mNSteps > MTV_RHYTHM_SPACE_MAX_MATERIALIZED_STEPS) {
+    char msg[100];
+    sprintf_s(msg, "n steps %d exceeds the maximum of %d of a materialized space", 
+      mNSteps, MTV_RHYTHM_SPACE_MAX_MATERIALIZED_STEPS);
+    throw std::runtime_error(msg);
+  }
+
+  if (mFormat == PointFormat::FLOAT32) {
+    mPoints = (Tension*)alignedMalloc(
+      (size_t)mNPoints * mNSteps * sizeof(Tension), MTV_RHYTHM_SPACE_POINT_ALIGNMENT);
+  } else {
+    mLevels = (uint8_t*)alignedMalloc((size_t)mNPoints * mNSteps, MTV_RHYTHM_SPACE_POINT_ALIGNMENT);
+  }
+
+  if (!mPoints && !mLevels)
+    throw std::bad_alloc();
+
+  if (nThreads <= 0)
+    nThreads = std::max(1, (int)std::thread::hardware_concurrency());
+
+  // shared by all workers, so that meters without a beat table don't recompute it per pattern
+  const NaturalDurationTable& naturalDurations = mMeterTables->getNaturalDurations();
+
+  // the pattern id range is split in chunks, which are handed out to the workers in order
+  const int nChunks = (int)((mNPoints + MTV_RHYTHM_SPACE_FILL_CHUNK_SIZE - 1) / MTV_RHYTHM_SPACE_FILL_CHUNK_SIZE);
+  nThreads = std::min(nThreads, nChunks);
+
+  std::atomic<int> nextChunk(0);
+  std::atomic<int> nFinishedChunks(0);
+
+  auto cancelled = [cancellationToken]() {
+    return cancellationToken && cancellationToken->isCancelled();
+  };
+
+  auto worker = [&]() {
+    // each worker reuses its own rhythm pattern object to compute MTVs for all its combinations
+    RhythmPattern rp(mTs, mStepUnit);
+    std::vector<Tension> mtv((size_t)mNSteps * MTV_BLOCK_KERNEL_N_LANES);
+    int chunk;
+
+    while (!cancelled() && (chunk = nextChunk++) < nChunks) {
+      const PatternId begin = (PatternId)chunk * MTV_RHYTHM_SPACE_FILL_CHUNK_SIZE;
+      const PatternId end = std::min(begin + MTV_RHYTHM_SPACE_FILL_CHUNK_SIZE, mNPoints);
+      fillRange(begin, end, prf, prfRange, naturalDurations, rp, mtv.data());
+      ++nFinishedChunks;
+    }
+  };
+
+  // reports the progress, at most once per 1 / MTV_RHYTHM_SPACE_FILL_PROGRESS_STEPS
+  int lastReportedStep = -1;
+  auto reportProgress = [&]() {
+    if (!progressFuncCallback) return;
+    const double progress = (double)nFinishedChunks / nChunks;
+    const int step = (int)(progress * MTV_RHYTHM_SPACE_FILL_PROGRESS_STEPS);
+    if (step == lastReportedStep) return;
+    lastReportedStep = step;
+    progressFuncCallback(progress);
+  };
+
+  if (nThreads == 1) {
+    RhythmPattern rp(mTs, mStepUnit);
+    std::vector<Tension> mtv((size_t)mNSteps * MTV_BLOCK_KERNEL_N_LANES);
+
+    for (int chunk = 0; chunk < nChunks && !cancelled(); ++chunk) {
+      const PatternId begin = (PatternId)chunk * MTV_RHYTHM_SPACE_FILL_CHUNK_SIZE;
+      const PatternId end = std::min(begin + MTV_RHYTHM_SPACE_FILL_CHUNK_SIZE, mNPoints);
+      fillRange(begin, end, prf, prfRange, naturalDurations, rp, mtv.data());
+      ++nFinishedChunks;
+      reportProgress();
+    }
+  } else {
+    // compute tension vectors for all possible rhythm patterns on the worker threads, while 
+    // this thread reports the aggregated progress (so that the callback is never called concurrently)
+    std::vector<std::thread> workers;
+    workers.reserve(nThreads);
+
+    for (int i = 0; i < nThreads; ++i)
+      workers.emplace_back(worker);
+
+    while (nFinishedChunks < nChunks && !cancelled()) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(MTV_RHYTHM_SPACE_FILL_PROGRESS_INTERVAL_MS));
+      reportProgress();
+    }
+
+    // after a cancellation, the workers stop at their next chunk boundary
+    for (auto& thread : workers)
+      thread.join();
+
+    if (nFinishedChunks == nChunks)
+      reportProgress();
+  }
+
+  if (nFinishedChunks < nChunks) {
+    alignedFree(mPoints);
+    alignedFree(mLevels);
+    mPoints = nullptr;
+    mLevels = nullptr;
+    return false;
   }
 
+  if (mIndexEnabled)
+    mIndex.reset(new MTVVPTree(mPoints, mNPoints, mNSteps));
+
   mReady = true;
+  return true;
 }
 
-const Tension * const MTVRhythmSpace::getMTV(const PatternId patternId) const
+void MTVRhythmSpace::save(const std::string& path) const
 {
   checkIfReady();
 
+  if (mBackend != QueryBackend::MATERIALIZED)
+    throw std::runtime_error("MTVRhythmSpace::save() requires a MATERIALIZED space");
+
+  const MetricalSalienceProfile prf = mMeterTables->getMetricalSalienceProfile(MTV_RHYTHM_SPACE_ROOT_SALIENCE);
+  const size_t headerSize = sizeof(SpaceFileHeader) + mNSteps;
+  const size_t alignment = MTV_RHYTHM_SPACE_POINT_ALIGNMENT;
+
+  SpaceFileHeader header;
+  std::memcpy(header.magic, SPACE_FILE_MAGIC, sizeof(header.magic));
+  header.version = MTV_RHYTHM_SPACE_FILE_VERSION;
+  header.byteOrderMark = SPACE_FILE_BYTE_ORDER_MARK;
+  header.numerator = mTs.getNumerator();
+  header.denominator = mTs.getDenominator();
+  header.stepUnitNumerator = mStepUnit->getNumerator();
+  header.stepUnitDenominator = mStepUnit->getDenominator();
+  header.rootSalience = MTV_RHYTHM_SPACE_ROOT_SALIENCE;
+  header.layout = mLayout;
+  header.format = mFormat;
+  header.nSteps = mNSteps;
+  header.reserved = 0;
+  header.nPoints = mNPoints;
+  header.dataOffset = (headerSize + alignment - 1) / alignment * alignment;
+  header.dataSize = getMemorySize();
+
+  // the file is written next to the target and renamed over it once complete, so that an interrupted save never 
+  // leaves a partial file behind, and spaces that mapped the previous file keep reading it
+  const std::string tmpPath = path + ".tmp";
+  std::ofstream file(tmpPath, std::ios::binary | std::ios::trunc);
+  const std::vector<char> padding((size_t)header.dataOffset - headerSize, 0);
+  const char * data = mFormat == PointFormat::FLOAT32 ? (const char*)mPoints : (const char*)mLevels;
+
+  file.write((const char*)&header, sizeof(header));
+  file.write((const char*)prf.data(), mNSteps);
+  file.write(padding.data(), padding.size());
+  file.write(data, (std::streamsize)header.dataSize);
+  file.close();
+
+  if (!file || !replaceFile(tmpPath.c_str(), path.c_str())) {
+    std::remove(tmpPath.c_str());
+    char msg[300];
+    sprintf_s(msg, "can't write space file %s", path.c_str());
+    throw std::runtime_error(msg);
+  }
+}
+
+bool MTVRhythmSpace::open(const std::string& path)
+{
+  if (mReady) return true;
+  assert(!mPoints && !mLevels);
+
+  if (mBackend != QueryBackend::MATERIALIZED)
+    throw std::runtime_error("MTVRhythmSpace::open() requires a MATERIALIZED space");
+
+  std::unique_ptr<MappedFile> file;
   try {
-    return const_cast<const Tension * const>(mPoints[(size_t)patternId]);
+    file.reset(new MappedFile(path));
+  } catch (const std::runtime_error&) {
+    return false;
+  }
+
+  if (file->getSize() < sizeof(SpaceFileHeader))
+    return false;
+
+  SpaceFileHeader header;
+  std::memcpy(&header, file->getData(), sizeof(header));
+
+  MetricalSalienceProfile prf;
+  MetricalSalienceRange prfRange;
+  setupSalience(prf, prfRange);
+
+  // the file must have been written by this version for exactly this space
+  const bool matches = std::memcmp(header.magic, SPACE_FILE_MAGIC, sizeof(header.magic)) == 0
+    && header.version == MTV_RHYTHM_SPACE_FILE_VERSION
+    && header.byteOrderMark == SPACE_FILE_BYTE_ORDER_MARK
+    && header.numerator == mTs.getNumerator()
+    && header.denominator == mTs.getDenominator()
+    && header.stepUnitNumerator == mStepUnit->getNumerator()
+    && header.stepUnitDenominator == mStepUnit->getDenominator()
+    && header.rootSalience == MTV_RHYTHM_SPACE_ROOT_SALIENCE
+    && header.layout == mLayout
+    && header.format == mFormat
+    && header.nSteps == mNSteps
+    && header.nPoints == mNPoints
+    && header.dataOffset % MTV_RHYTHM_SPACE_POINT_ALIGNMENT == 0
+    && header.dataOffset >= sizeof(header) + mNSteps
+    && header.dataSize == getMemorySize()
+    && header.dataOffset + header.dataSize <= file->getSize()
+    && std::equal(prf.begin(), prf.begin() + mNSteps, (const MetricalSalience*)(file->getData() + sizeof(header)));
+
+  if (!matches)
+    return false;
+
+  // the points are used in place, they are never written after fill()
+  uint8_t * data = const_cast<uint8_t*>(file->getData()) + header.dataOffset;
+  if (mFormat == PointFormat::FLOAT32)
+    mPoints = (Tension*)data;
+  else
+    mLevels = data;
+
+  mMappedFile = std::move(file);
+
+  if (mIndexEnabled)
+    mIndex.reset(new MTVVPTree(mPoints, mNPoints, mNSteps));
+
+  mReady = true;
+  return true;
+}
+
+std::string MTVRhythmSpace::getFileName() const
+{
+  char name[100];
+  sprintf_s(name, "mtv_%d-%d_%d-%d_r%d_%s_%s.v%d.mtvs", mTs.getNumerator(), mTs.getDenominator(),
+    mStepUnit->getNumerator(), mStepUnit->getDenominator(), MTV_RHYTHM_SPACE_ROOT_SALIENCE, 
+    mLayout == PointLayout::ROW_MAJOR ? "row" : "col", mFormat == PointFormat::FLOAT32 ? "f32" : "u8", 
+    MTV_RHYTHM_SPACE_FILE_VERSION);
+  return name;
+}
+
+void MTVRhythmSpace::fillRange(
+  PatternId begin, 
+  PatternId end,
+  const MetricalSalienceProfile& prf,
+  MetricalSalienceRange salienceRange,
+  const NaturalDurationTable& naturalDurations,
+  RhythmPattern& rp,
+  Tension * mtvScratch
+)
+{
+  const bool useBeatTable = mBeatTable && mBeatTable->isValid();
+
+  const bool writeDirectly = mFormat == PointFormat::FLOAT32 && mLayout == PointLayout::ROW_MAJOR;
+  const int salienceDelta = (int)mLevelTensions.size() - 1;
+
+  for (PatternId blockBegin = begin; blockBegin < end; blockBegin += MTV_BLOCK_KERNEL_N_LANES) {
+    const size_t blockSize = (size_t)std::min(end - blockBegin, (PatternId)MTV_BLOCK_KERNEL_N_LANES);
+    Tension * mtvs = writeDirectly
+      ? mPoints + (size_t)blockBegin * mNSteps
+      : mtvScratch;
+
+    if (mBlockKernel) {
+      mBlockKernel->computeMTVRange(blockBegin, blockSize, mtvs);
+    } else {
+      for (size_t i = 0; i < blockSize; ++i) {
+        const PatternId patternId = blockBegin + i;
+        Tension * mtv = mtvs + i * mNSteps;
+
+        if (mStaticMTVKernel) {
+          mStaticMTVKernel(patternId, mtv);
+        } else if (useBeatTable) {
+          computeMTV(patternId, *mBeatTable, mtv);
+        } else {
+          rp.setPatternId(patternId);
+          computeMTV(rp, naturalDurations, prf, salienceRange, mtv);
+        }
+      }
+    }
+
+    if (writeDirectly)
+      continue;
+
+    for (size_t i = 0; i < blockSize; ++i) {
+      const PatternId patternId = blockBegin + i;
+      const Tension * mtv = mtvScratch + i * mNSteps;
+
+      if (mFormat == PointFormat::FLOAT32) {
+        for (int step = 0; step < mNSteps; ++step)
+          mPoints[getPointIndex(patternId, step)] = mtv[step];
+      } else {
+        for (int step = 0; step < mNSteps; ++step)
+          mLevels[getPointIndex(patternId, step)] = (uint8_t)std::lround(mtv[step] * salienceDelta);
+      }
+    }
   }
-  catch (const std::out_of_range&) {
+}
+
+const Tension * const MTVRhythmSpace::getMTV(const PatternId patternId) const
+{
+  checkIfReady();
+
+  if (mBackend != QueryBackend::MATERIALIZED || mLayout != PointLayout::ROW_MAJOR || mFormat != PointFormat::FLOAT32)
+    throw std::runtime_error("MTVRhythmSpace::getMTV(PatternId) requires a MATERIALIZED ROW_MAJOR FLOAT32 space");
+
+  if (patternId >= mNPoints)
     return nullptr;
+
+  return mPoints + (size_t)patternId * mNSteps;
+}
+
+bool MTVRhythmSpace::getMTV(const PatternId patternId, Tension * mtvOut) const
+{
+  checkIfReady();
+
+  if (patternId >= mNPoints)
+    return false;
+
+  if (mBackend == QueryBackend::IMPLICIT) {
+    if (mStaticMTVKernel)
+      mStaticMTVKernel(patternId, mtvOut);
+    else
+      computeMTV(patternId, *mBeatTable, mtvOut);
+    return true;
   }
+
+  for (int step = 0; step < mNSteps; ++step)
+    mtvOut[step] = getTension(patternId, step);
+
+  return true;
 }
 
-int MTVRhythmSpace::getPatternCount() const
+PatternId MTVRhythmSpace::getPatternCount() const
 {
   return mNPoints;
 }
@@ -82,46 +452,420 @@ int MTVRhythmSpace::getDimensions() const
   return mNSteps;
 }
 
-PatternId MTVRhythmSpace::getClosestPattern(const Tension * const mtv)
+size_t MTVRhythmSpace::getMemorySize() const
 {
-  if (!equalsDistanceCacheTargetPoint(mtv))
-    updateDistanceCache(mtv);
-  return mDistanceCache.front().patternId;
+  if (mBackend != QueryBackend::MATERIALIZED)
+    return 0;
+
+  return (size_t)mNPoints * mNSteps * (mFormat == PointFormat::FLOAT32 ? sizeof(Tension) : sizeof(uint8_t));
 }
 
-PatternId MTVRhythmSpace::getRandomPatternCloseTo(const Tension * const mtv, float distanceSD)
+size_t MTVRhythmSpace::getTotalMemorySize() const
 {
-  if (!equalsDistanceCacheTargetPoint(mtv))
-    updateDistanceCache(mtv);
-  
+  if (!mReady)
+    return 0;
+
+  size_t size = getMemorySize();
+  if (mIndex) size += mIndex->getMemorySize();
+  if (mBeatTable) size += mBeatTable->getMemorySize();
+  if (mBlockKernel) size += mBlockKernel->getMemorySize();
+  return size;
+}
+
+PatternId MTVRhythmSpace::getClosestPattern(const Tension * const mtv, QueryContext& ctx) const
+{
+  if (mBackend == QueryBackend::IMPLICIT) {
+    checkIfReady();
+    return mBeatSearch->findClosest(mtv);
+  }
+
+  checkIfReady();  // before reading the index, which is set up with the points
+  const bool cached = ctx.isCacheOf(*this, mtv);
+
+  // the index answers without scanning, unless the context already holds this target's distances
+  if (mIndex && !cached)
+    return mIndex->findClosest(mtv);
+
+  if (!cached)
+    updateDistanceCache(mtv, ctx);
+
+  if (ctx.mKeyFormat == DistanceKeyFormat::FLOAT_KEYS) {
+    ctx.ensureSorted(1);
+    return ctx.mDistanceCache.front().patternId;
+  }
+
+  // keys are rounded monotonically, so the closest pattern has the closest key, but it may share it 
+  // with farther ones: refine with the exact distances (ties keep the lowest pattern id)
+  const uint16_t key = ctx.mNonEmptyKeys.front();
+  PatternId closestPattern = ctx.mKeyPatterns[ctx.mKeyOffsets[key]];
+  float closestSquaredDistance = getSquaredDistance(mtv, closestPattern);
+
+  for (uint32_t pos = ctx.mKeyOffsets[key] + 1; pos < ctx.mKeyOffsets[key + 1]; ++pos) {
+    const float squaredDistance = getSquaredDistance(mtv, ctx.mKeyPatterns[pos]);
+    if (squaredDistance < closestSquaredDistance) {
+      closestSquaredDistance = squaredDistance;
+      closestPattern = ctx.mKeyPatterns[pos];
+    }
+  }
+
+  return closestPattern;
+}
+
+PatternId MTVRhythmSpace::getRandomPatternCloseTo(const Tension * const mtv, QueryContext& ctx, float distanceSD) const
+{
+  if (mBackend == QueryBackend::IMPLICIT)
+    throw std::runtime_error("MTVRhythmSpace::getRandomPatternCloseTo requires a MATERIALIZED space");
+
+  if (!ctx.isCacheOf(*this, mtv))
+    updateDistanceCache(mtv, ctx);
+
+  std::vector<DistanceCacheEntry>& cache = ctx.mDistanceCache;
   std::normal_distribution<float> normDist(0.0, distanceSD);
-  const float randomDistance = std::min(std::abs(normDist(mRandom)), 1.0f);
+  const float randomDistance = std::min(std::abs(normDist(ctx.mRandom)), 1.0f);
 
-  // Find the first pattern exceeding the target distance
+  if (ctx.mKeyFormat != DistanceKeyFormat::FLOAT_KEYS) {
+    // pick the closest non-empty key (the farther one on ties, as below), then a pattern in it
+    const std::vector<uint16_t>& keys = ctx.mNonEmptyKeys;
+    const uint32_t randomKey = (uint32_t)(randomDistance * ctx.getMaxKey() + 0.5f);
+    auto keyIt = std::lower_bound(keys.begin(), keys.end(), randomKey);
+
+    if (keyIt == keys.end() || (keyIt != keys.begin() && randomKey - *(keyIt - 1) < *keyIt - randomKey))
+      --keyIt;
+
+    std::uniform_int_distribution<uint32_t> uniDist(ctx.mKeyOffsets[*keyIt], ctx.mKeyOffsets[*keyIt + 1] - 1);
+    return ctx.mKeyPatterns[uniDist(ctx.mRandom)];
+  }
+
+  // the cache is ordered by squared distance, so search the squared random distance instead
+  const float randomSquaredDistance = randomDistance * randomDistance * mNSteps;
+
+  // Find the first pattern exceeding the target distance (only the sorted prefix is searched, which is 
+  // extended until it contains such pattern, if there is one)
+  ctx.ensureSortedPast(randomSquaredDistance);
+  const auto sortedBegin = cache.begin();
+  auto sortedEnd = sortedBegin + ctx.mSortedCount;
   std::vector<DistanceCacheEntry>::iterator lowerBound = std::lower_bound(
-    mDistanceCache.begin(), mDistanceCache.end(), randomDistance);
+    sortedBegin, sortedEnd, randomSquaredDistance);
+
+  // all patterns are closer than the target distance, the farthest cluster is the closest one
+  if (lowerBound == sortedEnd)
+    lowerBound = std::lower_bound(sortedBegin, sortedEnd, (sortedEnd - 1)->squaredDistance);
   
   // The first pattern exceedig the target is not necesarily the closest one to the target (it may 
   // also be the previous cluster of patterns). Check if this is the case and if so, re-find the 
   // lower bound of the previous cluster's distance to the mtv.
-  if (lowerBound != mDistanceCache.begin()) {
-    const float prevDistanceToTarget = (lowerBound - 1)->distanceToTarget;
-    const float delta = std::abs(lowerBound->distanceToTarget - randomDistance);
-    const float prevDelta = std::abs(prevDistanceToTarget - randomDistance);
+  if (lowerBound != sortedBegin) {
+    const float prevSquaredDistance = (lowerBound - 1)->squaredDistance;
+    const float delta = std::abs(normalizeSquaredDistance(lowerBound->squaredDistance) - randomDistance);
+    const float prevDelta = std::abs(normalizeSquaredDistance(prevSquaredDistance) - randomDistance);
 
     if (prevDelta < delta)
-      lowerBound = std::lower_bound(mDistanceCache.begin(), lowerBound, prevDistanceToTarget);
+      lowerBound = std::lower_bound(sortedBegin, lowerBound, prevSquaredDistance);
   }
-  
-  // Find the upper bound of the cluster of patterns with equal distances to the target mtv
+
+  // Find the upper bound of the cluster of patterns with equal distances to the target mtv (the 
+  // sorted prefix doesn't move when extended, so positions stay valid)
+  const int lowerBoundPos = lowerBound - sortedBegin;
+  const float clusterSquaredDistance = lowerBound->squaredDistance;
+  ctx.ensureSortedPast(clusterSquaredDistance);
+  sortedEnd = cache.begin() + ctx.mSortedCount;
+
   std::vector<DistanceCacheEntry>::iterator upperBound = std::upper_bound(
-    lowerBound, mDistanceCache.end(), lowerBound->distanceToTarget);
+    cache.begin() + lowerBoundPos, sortedEnd, clusterSquaredDistance);
 
-  const int lowerBoundPos = lowerBound - mDistanceCache.begin();
-  const int upperBoundPos = upperBound - mDistanceCache.begin() - 1;  // -1 for [min, max] ( not [min, max) )
+  const int upperBoundPos = upperBound - cache.begin() - 1;  // -1 for [min, max] ( not [min, max) )
 
   std::uniform_int_distribution<int> uniDist(lowerBoundPos, upperBoundPos);
-  return mDistanceCache[uniDist(mRandom)].patternId;
+  return cache[uniDist(ctx.mRandom)].patternId;
+}
+
+std::vector<MTVRhythmSpace::Neighbour> MTVRhythmSpace::getKNearest(const Tension * const mtv, size_t k) const
+{
+  checkIfReady();
+
+  if (mBackend == QueryBackend::IMPLICIT)
+    throw std::runtime_error("MTVRhythmSpace::getKNearest requires a MATERIALIZED space");
+
+  if (mIndex)
+    return toNeighbours(mIndex->findKNearest(mtv, k));
+
+  k = (size_t)std::min((PatternId)k, mNPoints);
+  std::vector<DistanceCacheEntry> heap;  // max-heap of the k closest entries so far
+  heap.reserve(k);
+
+  if (k > 0) {
+    scanDistanceBlocks(mtv, 1, [&](size_t, PatternId begin, const float * squaredDistances, size_t count) {
+      for (size_t i = 0; i < count; ++i) {
+        // patterns come in id order, so a pattern as far as the farthest kept one never replaces it
+        if (heap.size() == k) {
+          if (!(squaredDistances[i] < heap.front().squaredDistance)) continue;
+          std::pop_heap(heap.begin(), heap.end());
+          heap.pop_back();
+        }
+        heap.push_back({ squaredDistances[i], (uint32_t)(begin + i) });
+        std::push_heap(heap.begin(), heap.end());
+      }
+    });
+  }
+
+  std::sort_heap(heap.begin(), heap.end());
+
+  std::vector<Neighbour> neighbours(heap.size());
+  for (size_t i = 0; i < heap.size(); ++i)
+    neighbours[i] = { heap[i].patternId, normalizeSquaredDistance(heap[i].squaredDistance) };
+
+  return neighbours;
+}
+
+std::vector<MTVRhythmSpace::Neighbour> MTVRhythmSpace::getWithinRadius(const Tension * const mtv, float radius) const
+{
+  checkIfReady();
+
+  if (mBackend == QueryBackend::IMPLICIT)
+    throw std::runtime_error("MTVRhythmSpace::getWithinRadius requires a MATERIALIZED space");
+
+  // compare squared distances, as the cache does (and the index, which gives the same matches)
+  const float squaredRadius = getMaxSquaredDistance(radius);
+
+  if (mIndex)
+    return toNeighbours(mIndex->findWithinRadius(mtv, squaredRadius));
+
+  std::vector<DistanceCacheEntry> matches;
+
+  scanDistanceBlocks(mtv, 1, [&](size_t, PatternId begin, const float * squaredDistances, size_t count) {
+    for (size_t i = 0; i < count; ++i) {
+      if (squaredDistances[i] <= squaredRadius)
+        matches.push_back({ squaredDistances[i], (uint32_t)(begin + i) });
+    }
+  });
+
+  std::sort(matches.begin(), matches.end());
+
+  std::vector<Neighbour> neighbours(matches.size());
+  for (size_t i = 0; i < matches.size(); ++i)
+    neighbours[i] = { matches[i].patternId, normalizeSquaredDistance(matches[i].squaredDistance) };
+
+  return neighbours;
+}
+
+std::vector<MTVRhythmSpace::DistanceLevel> MTVRhythmSpace::getDistanceHistogram(const Tension * const mtv) const
+{
+  checkIfReady();
+
+  if (mBackend == QueryBackend::IMPLICIT)
+    throw std::runtime_error("MTVRhythmSpace::getDistanceHistogram requires a MATERIALIZED space");
+
+  // levels are told apart by squared distance, as the distance cache does
+  std::unordered_map<float, PatternId> counts;
+
+  scanDistanceBlocks(mtv, 1, [&](size_t, PatternId, const float * squaredDistances, size_t count) {
+    for (size_t i = 0; i < count; ++i)
+      ++counts[squaredDistances[i]];
+  });
+
+  std::vector<std::pair<float, PatternId>> levels(counts.begin(), counts.end());
+  std::sort(levels.begin(), levels.end());
+
+  std::vector<DistanceLevel> histogram;
+  histogram.reserve(levels.size());
+  PatternId cumulativeCount = 0;
+
+  for (const auto& level : levels) {
+    cumulativeCount += level.second;
+    histogram.push_back({ normalizeSquaredDistance(level.first), level.second, cumulativeCount });
+  }
+
+  return histogram;
+}
+
+PatternId MTVRhythmSpace::countWithinDistance(const Tension * const mtv, float distance) const
+{
+  checkIfReady();
+
+  if (mBackend == QueryBackend::IMPLICIT)
+    throw std::runtime_error("MTVRhythmSpace::countWithinDistance requires a MATERIALIZED space");
+
+  const float squaredDistance = getMaxSquaredDistance(distance);
+  PatternId total = 0;
+
+  scanDistanceBlocks(mtv, 1, [&](size_t, PatternId, const float * squaredDistances, size_t count) {
+    for (size_t i = 0; i < count; ++i)
+      total += squaredDistances[i] <= squaredDistance;
+  });
+
+  return total;
+}
+
+PatternId MTVRhythmSpace::countWithinDistance(const std::vector<DistanceLevel>& histogram, float distance)
+{
+  const auto it = std::upper_bound(histogram.begin(), histogram.end(), distance, 
+    [](float d, const DistanceLevel& level) { return d < level.distance; });
+  return it == histogram.begin() ? 0 : (it - 1)->cumulativeCount;
+}
+
+float MTVRhythmSpace::getMaxSquaredDistance(float distance) const
+{
+  // radius * radius * nSteps doesn't round-trip through normalizeSquaredDistance, so step it to the last float 
+  // that does (normalizeSquaredDistance is monotonic, this takes a few ulps at most)
+  float squaredDistance = distance * distance * mNSteps;
+
+  if (distance < 0.0f)
+    return -1.0f;
+  if (!(squaredDistance < std::numeric_limits<float>::infinity()))
+    return squaredDistance;
+
+  while (squaredDistance > 0.0f && normalizeSquaredDistance(squaredDistance) > distance)
+    squaredDistance = std::nextafter(squaredDistance, 0.0f);
+
+  for (;;) {
+    const float next = std::nextafter(squaredDistance, std::numeric_limits<float>::infinity());
+    if (normalizeSquaredDistance(next) > distance) break;
+    squaredDistance = next;
+  }
+
+  return squaredDistance;
+}
+
+MTVRhythmSpace::NeighbourIterator MTVRhythmSpace::getNeighbours(const Tension * const mtv) const
+{
+  return NeighbourIterator(*this, mtv);
+}
+
+std::vector<MTVRhythmSpace::Neighbour> MTVRhythmSpace::toNeighbours(const std::vector<MTVVPTree::Match>& matches) const
+{
+  std::vector<Neighbour> neighbours(matches.size());
+
+  for (size_t i = 0; i < matches.size(); ++i)
+    neighbours[i] = { matches[i].patternId, normalizeSquaredDistance(matches[i].squaredDistance) };
+
+  return neighbours;
+}
+
+void MTVRhythmSpace::enableIndex()
+{
+  if (mReady)
+    throw std::runtime_error("MTVRhythmSpace::enableIndex() must be called before fill() or open()");
+
+  if (mBackend != QueryBackend::MATERIALIZED || mLayout != PointLayout::ROW_MAJOR || mFormat != PointFormat::FLOAT32)
+    throw std::runtime_error("MTVRhythmSpace::enableIndex() requires a MATERIALIZED ROW_MAJOR FLOAT32 space");
+
+  mIndexEnabled = true;
+}
+
+MTVRhythmSpace::DistanceSampler MTVRhythmSpace::getDistanceSampler(const Tension * const mtv, float distanceSD) const
+{
+  return DistanceSampler(*this, mtv, distanceSD);
+}
+
+void MTVRhythmSpace::getClosestPatterns(const Tension * const mtvs, size_t nTargets, PatternId * patternsOut) const
+{
+  checkIfReady();
+
+  if (mBackend == QueryBackend::IMPLICIT) {
+    for (size_t target = 0; target < nTargets; ++target)
+      patternsOut[target] = mBeatSearch->findClosest(mtvs + target * mNSteps);
+    return;
+  }
+
+  // running min per target, patterns are visited in id order so ties keep the lowest id (as in the cache order)
+  std::vector<float> minSquaredDistances(nTargets, std::numeric_limits<float>::infinity());
+  std::fill(patternsOut, patternsOut + nTargets, EMPTY_RHYTHM_PATTERN);
+
+  scanDistanceBlocks(mtvs, nTargets, [&](size_t target, PatternId begin, const float * squaredDistances, size_t count) {
+    float& minSquaredDistance = minSquaredDistances[target];
+    for (size_t i = 0; i < count; ++i) {
+      if (squaredDistances[i] < minSquaredDistance) {
+        minSquaredDistance = squaredDistances[i];
+        patternsOut[target] = begin + i;
+      }
+    }
+  });
+}
+
+void MTVRhythmSpace::getRandomPatternsCloseTo(const Tension * const mtvs, size_t nTargets, PatternId * patternsOut, 
+  QueryContext& ctx, float distanceSD, const float * distanceSDs, const std::mt19937::result_type * seeds) const
+{
+  checkIfReady();
+
+  if (mBackend == QueryBackend::IMPLICIT)
+    throw std::runtime_error("MTVRhythmSpace::getRandomPatternsCloseTo requires a MATERIALIZED space");
+
+  // The picked cluster is either the closest one at or beyond the random distance or the farthest one 
+  // before it, so both are tracked during the pass, along with a uniform pick among their patterns.
+  struct Pick
+  {
+    std::mt19937 random;
+    float randomDistance;
+    float randomSquaredDistance;
+    float belowSquaredDistance = -1.0f;  // farthest cluster before the random distance
+    uint64_t nBelow = 0;
+    PatternId belowPattern = EMPTY_RHYTHM_PATTERN;
+    float aboveSquaredDistance = std::numeric_limits<float>::infinity();  // closest cluster at or beyond it
+    uint64_t nAbove = 0;
+    PatternId abovePattern = EMPTY_RHYTHM_PATTERN;
+
+    // reservoir sampling of one pattern per cluster: the n-th pattern of a cluster replaces the pick with 1/n probability
+    inline void offer(float squaredDistance, PatternId patternId, float& clusterSquaredDistance, 
+      uint64_t& nInCluster, PatternId& pick, bool isCloser)
+    {
+      if (isCloser) {
+        clusterSquaredDistance = squaredDistance;
+        nInCluster = 1;
+        pick = patternId;
+      } else if (squaredDistance == clusterSquaredDistance && 
+        std::uniform_int_distribution<uint64_t>(0, nInCluster++)(random) == 0) {
+        pick = patternId;
+      }
+    }
+  };
+
+  std::vector<Pick> picks(nTargets);
+
+  for (size_t target = 0; target < nTargets; ++target) {
+    Pick& pick = picks[target];
+    pick.random.seed(seeds ? seeds[target] : ctx.mRandom());
+    std::normal_distribution<float> normDist(0.0, distanceSDs ? distanceSDs[target] : distanceSD);
+    pick.randomDistance = std::min(std::abs(normDist(pick.random)), 1.0f);
+    pick.randomSquaredDistance = pick.randomDistance * pick.randomDistance * mNSteps;
+  }
+
+  scanDistanceBlocks(mtvs, nTargets, [&](size_t target, PatternId begin, const float * squaredDistances, size_t count) {
+    Pick& pick = picks[target];
+    for (size_t i = 0; i < count; ++i) {
+      const float squaredDistance = squaredDistances[i];
+      if (squaredDistance < pick.randomSquaredDistance) {
+        pick.offer(squaredDistance, begin + i, pick.belowSquaredDistance, pick.nBelow, pick.belowPattern, 
+          squaredDistance > pick.belowSquaredDistance);
+      } else {
+        pick.offer(squaredDistance, begin + i, pick.aboveSquaredDistance, pick.nAbove, pick.abovePattern, 
+          squaredDistance < pick.aboveSquaredDistance);
+      }
+    }
+  });
+
+  // same choice as getRandomPatternCloseTo: the previous cluster wins if it's strictly closer to the random distance
+  for (size_t target = 0; target < nTargets; ++target) {
+    const Pick& pick = picks[target];
+    bool below = pick.nAbove == 0;
+
+    if (!below && pick.nBelow > 0) {
+      const float delta = std::abs(normalizeSquaredDistance(pick.aboveSquaredDistance) - pick.randomDistance);
+      const float prevDelta = std::abs(normalizeSquaredDistance(pick.belowSquaredDistance) - pick.randomDistance);
+      below = prevDelta < delta;
+    }
+
+    patternsOut[target] = below ? pick.belowPattern : pick.abovePattern;
+  }
+}
+
+PatternId MTVRhythmSpace::getClosestPattern(const Tension * const mtv)
+{
+  return getClosestPattern(mtv, mDefaultContext);
+}
+
+PatternId MTVRhythmSpace::getRandomPatternCloseTo(const Tension * const mtv, float distanceSD)
+{
+  return getRandomPatternCloseTo(mtv, mDefaultContext, distanceSD);
 }
 
 float MTVRhythmSpace::getDistance(const Tension * const mtvA, const Tension * const mtvB) const
@@ -144,38 +888,481 @@ void MTVRhythmSpace::checkIfReady() const
   }
 }
 
-void MTVRhythmSpace::updateDistanceCache(const Tension * const targetMtv)
+void MTVRhythmSpace::updateDistanceCache(const Tension * const targetMtv, QueryContext& ctx) const
 {
   checkIfReady();
-  mDistanceCache.clear();
 
-  for (PatternId patternId = 0; patternId < mNPoints; ++patternId) {
-    const float distance = getDistance(targetMtv, mPoints[(size_t)patternId]);
-    mDistanceCache.push_back({ distance, patternId });
+  if (ctx.mKeyFormat != DistanceKeyFormat::FLOAT_KEYS) {
+    updateKeyedDistanceCache(targetMtv, ctx);
+    return;
   }
 
-  // sorts the distances using the default std::pair comparator, which first compares 
-  // the first element (distance) and then the second
-  std::sort(mDistanceCache.begin(), mDistanceCache.end());
+  if (updateDistanceCacheIncrementally(targetMtv, ctx))
+    return;
+
+  std::vector<DistanceCacheEntry>& cache = ctx.mDistanceCache;
+  cache.clear();
+  cache.reserve((size_t)mNPoints);
+  ctx.mSortedCount = 0;
+
+  // compute the squared distances block by block with the distance kernel
+  float squaredDistances[MTV_RHYTHM_SPACE_DISTANCE_BLOCK_SIZE];
+
+  if (mFormat == PointFormat::QUANTIZED_UINT8) {
+    if (scanQuantizedPoints(targetMtv, ctx))
+      ctx.mSortedCount = cache.size();
+  } else for (PatternId begin = 0; begin < mNPoints; begin += MTV_RHYTHM_SPACE_DISTANCE_BLOCK_SIZE) {
+    const size_t count = (size_t)std::min((PatternId)MTV_RHYTHM_SPACE_DISTANCE_BLOCK_SIZE, mNPoints - begin);
+
+    if (mLayout == PointLayout::ROW_MAJOR) {
+      computeSquaredDistances(targetMtv, mPoints + (size_t)begin * mNSteps, count, mNSteps, squaredDistances);
+    } else {
+      computeSquaredDistancesColumnMajor(targetMtv, mPoints, (size_t)mNPoints, (size_t)begin, 
+        count, mNSteps, squaredDistances);
+    }
+
+    for (size_t i = 0; i < count; ++i)
+      cache.push_back({ squaredDistances[i], (uint32_t)(begin + i) });
+  }
+
+  // sorts the distances (or the first ones, see DistanceCacheMode) using the entry comparator, 
+  // which first compares the distance and then the pattern id
+  ctx.ensureSorted(ctx.mMode == DistanceCacheMode::FULL_SORT ? cache.size() : ctx.mSortedPrefixSize);
 
   // update cache target point
-  for (int pos = 0; pos < mNSteps; ++pos)
-    mDistanceCacheTargetPoint[pos] = targetMtv[pos];
+  ctx.mTarget.assign(targetMtv, targetMtv + mNSteps);
+  ctx.mSpaceId = mId;
+  ctx.mNIncrementalUpdates = 0;
+}
+
+void MTVRhythmSpace::updateKeyedDistanceCache(const Tension * const targetMtv, QueryContext& ctx) const
+{
+  const uint32_t maxKey = ctx.getMaxKey();
+  const float keyScale = (float)maxKey / std::sqrt((float)mNSteps);
+  std::vector<uint32_t>& offsets = ctx.mKeyOffsets;
+  std::vector<uint16_t> keys((size_t)mNPoints);  // only needed until the patterns are ordered
+
+  offsets.assign(maxKey + 2, 0);
+
+  scanDistanceBlocks(targetMtv, 1, [&](size_t, PatternId begin, const float * squaredDistances, size_t count) {
+    for (size_t i = 0; i < count; ++i) {
+      const uint32_t key = std::min(maxKey, (uint32_t)(std::sqrt(squaredDistances[i]) * keyScale + 0.5f));
+      keys[(size_t)begin + i] = (uint16_t)key;
+      ++offsets[key + 1];
+    }
+  });
+
+  // counting sort, visiting the patterns in id order keeps equal keys sorted by pattern id
+  for (uint32_t key = 0; key <= maxKey; ++key)
+    offsets[key + 1] += offsets[key];
+
+  ctx.mKeyPatterns.resize((size_t)mNPoints);
+  ctx.mNonEmptyKeys.clear();
+
+  for (uint32_t key = 0; key <= maxKey; ++key) {
+    if (offsets[key + 1] > offsets[key])
+      ctx.mNonEmptyKeys.push_back((uint16_t)key);
+  }
+
+  for (PatternId patternId = 0; patternId < mNPoints; ++patternId)
+    ctx.mKeyPatterns[offsets[keys[(size_t)patternId]]++] = (uint32_t)patternId;
+
+  // the scatter moved each key's offset to the next key's, shift them back
+  for (uint32_t key = maxKey; key > 0; --key)
+    offsets[key] = offsets[key - 1];
+  offsets[0] = 0;
+
+  ctx.mTarget.assign(targetMtv, targetMtv + mNSteps);
+  ctx.mSpaceId = mId;
+  ctx.mNIncrementalUpdates = 0;
+}
+
+float MTVRhythmSpace::getSquaredDistance(const Tension * const mtv, PatternId patternId) const
+{
+  int32_t units = 0;
+  for (int step = 0; step < mNSteps; ++step)
+    units += getSquaredDiffUnits(mtv[step], getTension(patternId, step));
+  return unitsToSquaredDistance(units);
+}
+
+void MTVRhythmSpace::scanDistanceBlocks(const Tension * const mtvs, size_t nTargets, 
+  const std::function<void(size_t, PatternId, const float *, size_t)>& onBlock) const
+{
+  float squaredDistances[MTV_RHYTHM_SPACE_DISTANCE_BLOCK_SIZE];
+  std::vector<Tension> blockScratch;
+
+  if (mFormat == PointFormat::QUANTIZED_UINT8)
+    blockScratch.resize((size_t)MTV_RHYTHM_SPACE_DISTANCE_BLOCK_SIZE * mNSteps);
+
+  for (PatternId begin = 0; begin < mNPoints; begin += MTV_RHYTHM_SPACE_DISTANCE_BLOCK_SIZE) {
+    const size_t count = (size_t)std::min((PatternId)MTV_RHYTHM_SPACE_DISTANCE_BLOCK_SIZE, mNPoints - begin);
+    const Tension * block = blockScratch.data();
+
+    // quantized blocks are decoded once, then scored as row-major floats
+    if (mFormat == PointFormat::QUANTIZED_UINT8) {
+      for (size_t i = 0; i < count; ++i)
+        for (int step = 0; step < mNSteps; ++step)
+          blockScratch[i * mNSteps + step] = getTension(begin + i, step);
+    } else {
+      block = mPoints + (size_t)begin * mNSteps;
+    }
+
+    for (size_t target = 0; target < nTargets; ++target) {
+      const Tension * const targetMtv = mtvs + target * mNSteps;
+
+      if (mLayout == PointLayout::ROW_MAJOR || mFormat == PointFormat::QUANTIZED_UINT8) {
+        computeSquaredDistances(targetMtv, block, count, mNSteps, squaredDistances);
+      } else {
+        computeSquaredDistancesColumnMajor(targetMtv, mPoints, (size_t)mNPoints, (size_t)begin, 
+          count, mNSteps, squaredDistances);
+      }
+
+      onBlock(target, begin, squaredDistances, count);
+    }
+  }
+}
+
+bool MTVRhythmSpace::scanQuantizedPoints(const Tension * const targetMtv, QueryContext& ctx) const
+{
+  std::vector<DistanceCacheEntry>& cache = ctx.mDistanceCache;
+  const int nLevels = (int)mLevelTensions.size();
+  const int salienceDelta = nLevels - 1;
+
+  // check whether the target lies on the level grid, in which case the patterns can be ordered by integer keys
+  std::vector<int> targetLevels(mNSteps);
+  bool onGrid = salienceDelta > 0;
+
+  for (int step = 0; step < mNSteps && onGrid; ++step) {
+    const auto levelIt = std::find(mLevelTensions.begin(), mLevelTensions.end(), targetMtv[step]);
+    onGrid = levelIt != mLevelTensions.end();
+    targetLevels[step] = (int)(levelIt - mLevelTensions.begin());
+  }
+
+  // each step only takes nLevels values, so look the squared differences up per step and level (in the
+  // units of the distance kernels, which gives the same distances as decoding the points)
+  std::vector<int32_t> squaredDiffUnits((size_t)mNSteps * nLevels);
+  for (int step = 0; step < mNSteps; ++step) {
+    for (int level = 0; level < nLevels; ++level)
+      squaredDiffUnits[(size_t)step * nLevels + level] = getSquaredDiffUnits(targetMtv[step], mLevelTensions[level]);
+  }
+
+  auto getSquaredDistance = [&](PatternId patternId) {
+    int32_t units = 0;
+    for (int step = 0; step < mNSteps; ++step)
+      units += squaredDiffUnits[(size_t)step * nLevels + mLevels[getPointIndex(patternId, step)]];
+    return unitsToSquaredDistance(units);
+  };
+
+  if (!onGrid) {
+    for (PatternId patternId = 0; patternId < mNPoints; ++patternId)
+      cache.push_back({ getSquaredDistance(patternId), (uint32_t)patternId });
+
+    return false;
+  }
+
+  // integer squared distances in level steps, which fall in [0, nSteps * delta^2]. They order the
+  // patterns like their distances, up to the rounding of the level tensions within a key.
+  const int maxKey = mNSteps * salienceDelta * salienceDelta;
+  std::vector<uint32_t> keys((size_t)mNPoints);
+  std::vector<size_t> keyOffsets(maxKey + 2, 0);
+
+  for (PatternId patternId = 0; patternId < mNPoints; ++patternId) {
+    uint32_t key = 0;
+    for (int step = 0; step < mNSteps; ++step) {
+      const int delta = targetLevels[step] - mLevels[getPointIndex(patternId, step)];
+      key += delta * delta;
+    }
+    keys[(size_t)patternId] = key;
+    ++keyOffsets[key + 1];
+  }
+
+  // counting sort, visiting the patterns in id order keeps equal keys sorted by pattern id
+  for (int key = 0; key <= maxKey; ++key)
+    keyOffsets[key + 1] += keyOffsets[key];
+
+  std::vector<size_t> keyEnds(keyOffsets.begin() + 1, keyOffsets.end());
+  cache.resize((size_t)mNPoints);
+
+  for (PatternId patternId = 0; patternId < mNPoints; ++patternId) {
+    const uint32_t key = keys[(size_t)patternId];
+    cache[keyOffsets[key]++] = { getSquaredDistance(patternId), (uint32_t)patternId };
+  }
+
+  // finish with the entry comparator within each key
+  size_t keyBegin = 0;
+  for (size_t keyEnd : keyEnds) {
+    if (keyEnd - keyBegin > 1 && !std::is_sorted(cache.begin() + keyBegin, cache.begin() + keyEnd))
+      std::sort(cache.begin() + keyBegin, cache.begin() + keyEnd);
+    keyBegin = keyEnd;
+  }
+
+  return true;
 }
 
-bool MTVRhythmSpace::equalsDistanceCacheTargetPoint(const Tension * const mtv) const
+bool MTVRhythmSpace::updateDistanceCacheIncrementally(const Tension * const targetMtv, QueryContext& ctx) const
 {
-  if (!mDistanceCacheTargetPoint)
+  std::vector<DistanceCacheEntry>& cache = ctx.mDistanceCache;
+
+  // the cached distances are exact sums of units, so any number of updates gives the distances of a fresh scan
+  if (ctx.mSpaceId != mId || cache.empty())
     return false;
 
-  for (int i = 0; i < mNSteps; ++i) {
-    if (mtv[i] != mDistanceCacheTargetPoint[i])
-      return false;
+  int changedStep = -1;
+  for (int step = 0; step < mNSteps; ++step) {
+    if (targetMtv[step] == ctx.mTarget[step]) continue;
+    if (changedStep != -1) return false;
+    changedStep = step;
+  }
+
+  if (changedStep == -1)
+    return false;
+
+  // patterns with equal tensions on the changed step move by the same amount, so they keep their order
+  // relative to each other. Find the tension level of each entry and the delta of each level.
+  std::vector<Tension> levels;
+  std::vector<uint8_t> entryLevels(cache.size());
+
+  for (size_t i = 0; i < cache.size(); ++i) {
+    const Tension tension = getTension(cache[i].patternId, changedStep);
+    const size_t level = std::find(levels.begin(), levels.end(), tension) - levels.begin();
+
+    if (level == levels.size()) {
+      if (levels.size() == MTV_RHYTHM_SPACE_MAX_INCREMENTAL_LEVELS)
+        return false;
+      levels.push_back(tension);
+    }
+
+    entryLevels[i] = (uint8_t)level;
+  }
+
+  const Tension oldTarget = ctx.mTarget[changedStep];
+  const Tension newTarget = targetMtv[changedStep];
+  std::vector<float> levelDeltas(levels.size());
+
+  // in the units of the distance kernels, so that the sums stay exact
+  for (size_t level = 0; level < levels.size(); ++level) {
+    levelDeltas[level] = unitsToSquaredDistance(
+      getSquaredDiffUnits(newTarget, levels[level]) - getSquaredDiffUnits(oldTarget, levels[level]));
+  }
+
+  // a partially sorted cache only needs its prefix selected again, which skips the kernel scan
+  if (ctx.mSortedCount != cache.size()) {
+    for (size_t i = 0; i < cache.size(); ++i)
+      cache[i].squaredDistance += levelDeltas[entryLevels[i]];
+
+    ctx.mSortedCount = 0;
+    ctx.ensureSorted(ctx.mSortedPrefixSize);
+    ctx.mTarget[changedStep] = newTarget;
+    ++ctx.mNIncrementalUpdates;
+    return true;
+  }
+
+  // a sorted cache is split in one (sorted) group per level, and the groups are merged
+  std::vector<std::vector<DistanceCacheEntry>> groups(levels.size());
+
+  for (size_t i = 0; i < cache.size(); ++i) {
+    DistanceCacheEntry& entry = cache[i];
+    entry.squaredDistance += levelDeltas[entryLevels[i]];
+    groups[entryLevels[i]].push_back(entry);
+  }
+
+  // merge the groups pairwise, until only one is left
+  while (groups.size() > 1) {
+    std::vector<std::vector<DistanceCacheEntry>> merged((groups.size() + 1) / 2);
+    for (size_t i = 0; i + 1 < groups.size(); i += 2) {
+      merged[i / 2].resize(groups[i].size() + groups[i + 1].size());
+      std::merge(groups[i].begin(), groups[i].end(), groups[i + 1].begin(), groups[i + 1].end(), merged[i / 2].begin());
+    }
+    if (groups.size() % 2 == 1)
+      merged.back().swap(groups.back());
+    groups.swap(merged);
+  }
+
+  cache.swap(groups.front());
+
+  // rounding may have made some distances equal, in which case the pattern ids of such (adjacent) 
+  // entries may be out of order, which is repaired with an insertion sort
+  for (size_t i = 1; i < cache.size(); ++i) {
+    for (size_t j = i; j > 0 && cache[j] < cache[j - 1]; --j)
+      std::swap(cache[j], cache[j - 1]);
   }
 
+  ctx.mTarget[changedStep] = newTarget;
+  ++ctx.mNIncrementalUpdates;
+  return true;
+}
+
+
+MTVRhythmSpace::NeighbourIterator::NeighbourIterator(const MTVRhythmSpace& space, const Tension * const mtv) :
+  mSpace(space)
+{
+  space.checkIfReady();
+
+  if (space.mBackend == QueryBackend::IMPLICIT)
+    throw std::runtime_error("MTVRhythmSpace::NeighbourIterator requires a MATERIALIZED space");
+
+  mHeap.reserve((size_t)space.mNPoints);
+
+  space.scanDistanceBlocks(mtv, 1, [&](size_t, PatternId begin, const float * squaredDistances, size_t count) {
+    for (size_t i = 0; i < count; ++i)
+      mHeap.push_back({ squaredDistances[i], (uint32_t)(begin + i) });
+  });
+
+  std::make_heap(mHeap.begin(), mHeap.end(), isFarther);
+}
+
+bool MTVRhythmSpace::NeighbourIterator::next(Neighbour& neighbourOut)
+{
+  if (mHeap.empty())
+    return false;
+
+  std::pop_heap(mHeap.begin(), mHeap.end(), isFarther);
+  const QueryContext::DistanceCacheEntry& entry = mHeap.back();
+  neighbourOut = { entry.patternId, mSpace.normalizeSquaredDistance(entry.squaredDistance) };
+  mHeap.pop_back();
   return true;
 }
 
+MTVRhythmSpace::DistanceSampler::DistanceSampler(const MTVRhythmSpace& space, const Tension * const mtv, float distanceSD)
+{
+  space.checkIfReady();
+
+  if (space.mBackend == QueryBackend::IMPLICIT)
+    throw std::runtime_error("MTVRhythmSpace::DistanceSampler requires a MATERIALIZED space");
+
+  std::vector<DistanceCacheEntry> entries;
+  entries.reserve((size_t)space.mNPoints);
+
+  space.scanDistanceBlocks(mtv, 1, [&](size_t, PatternId begin, const float * squaredDistances, size_t count) {
+    for (size_t i = 0; i < count; ++i)
+      entries.push_back({ squaredDistances[i], (uint32_t)(begin + i) });
+  });
+
+  std::sort(entries.begin(), entries.end());
+  mPatterns.resize(entries.size());
+
+  for (size_t i = 0; i < entries.size(); ++i) {
+    if (i == 0 || entries[i].squaredDistance != entries[i - 1].squaredDistance) {
+      mLevelBegins.push_back(i);
+      mLevelDistances.push_back(space.normalizeSquaredDistance(entries[i].squaredDistance));
+    }
+    mPatterns[i] = entries[i].patternId;
+  }
+
+  mLevelBegins.push_back(entries.size());
+
+  // |N(0, sd)| falls below x with probability erf(x / (sd * sqrt(2)))
+  const size_t nLevels = mLevelDistances.size();
+  auto halfNormalCdf = [distanceSD](double x) {
+    return distanceSD > 0.0f ? std::erf(x / (distanceSD * std::sqrt(2.0))) : 1.0;
+  };
+
+  // a level wins the distances closer to it than to its neighbours, ties going to the farther level
+  std::vector<double> weights(nLevels);
+  double prevCdf = 0.0;
+
+  for (size_t level = 0; level + 1 < nLevels; ++level) {
+    const double cdf = halfNormalCdf(((double)mLevelDistances[level] + mLevelDistances[level + 1]) / 2);
+    weights[level] = cdf - prevCdf;
+    prevCdf = cdf;
+  }
+
+  weights[nLevels - 1] = 1.0 - prevCdf;
+  mLevelTable = AliasTable(weights);
+}
+
+PatternId MTVRhythmSpace::DistanceSampler::draw(std::mt19937& random) const
+{
+  const size_t level = mLevelTable.draw(random);
+  const size_t nPatterns = mLevelBegins[level + 1] - mLevelBegins[level];
+  const size_t ix = std::uniform_int_distribution<size_t>(0, nPatterns - 1)(random);
+  return mPatterns[mLevelBegins[level] + ix];
+}
+
+MTVRhythmSpace::QueryContext::QueryContext(DistanceCacheMode mode, std::mt19937::result_type seed) :
+  mMode(mode),
+  mKeyFormat(DistanceKeyFormat::FLOAT_KEYS),
+  mSortedPrefixSize(MTV_RHYTHM_SPACE_SORTED_PREFIX_SIZE),
+  mSortedCount(0),
+  mSpaceId(0),
+  mNIncrementalUpdates(0),
+  mRandom(seed)
+{
+}
+
+void MTVRhythmSpace::QueryContext::setDistanceCacheMode(DistanceCacheMode mode, size_t sortedPrefixSize)
+{
+  mMode = mode;
+  mSortedPrefixSize = std::max((size_t)1, sortedPrefixSize);
+
+  // invalidate the cache, so that the next query re-orders it with the new mode
+  invalidate();
+}
+
+void MTVRhythmSpace::QueryContext::setDistanceKeyFormat(DistanceKeyFormat format)
+{
+  mKeyFormat = format;
+  invalidate();
+
+  // release the buffers of the previous format (clear() keeps their capacity)
+  std::vector<DistanceCacheEntry>().swap(mDistanceCache);
+  std::vector<uint32_t>().swap(mKeyPatterns);
+  std::vector<uint32_t>().swap(mKeyOffsets);
+  std::vector<uint16_t>().swap(mNonEmptyKeys);
+}
+
+size_t MTVRhythmSpace::QueryContext::getMemorySize() const
+{
+  return mDistanceCache.capacity() * sizeof(DistanceCacheEntry)
+    + mKeyPatterns.capacity() * sizeof(uint32_t)
+    + mKeyOffsets.capacity() * sizeof(uint32_t)
+    + mNonEmptyKeys.capacity() * sizeof(uint16_t)
+    + mTarget.capacity() * sizeof(Tension);
+}
+
+void MTVRhythmSpace::QueryContext::invalidate()
+{
+  mDistanceCache.clear();
+  mKeyPatterns.clear();
+  mTarget.clear();
+  mSortedCount = 0;
+  mSpaceId = 0;
+}
+
+bool MTVRhythmSpace::QueryContext::isCacheOf(const MTVRhythmSpace& space, const Tension * const mtv) const
+{
+  if (mSpaceId != space.mId || (mDistanceCache.empty() && mKeyPatterns.empty()))
+    return false;
+
+  return std::equal(mTarget.begin(), mTarget.end(), mtv);
+}
+
+void MTVRhythmSpace::QueryContext::ensureSorted(size_t count)
+{
+  count = std::min(count, mDistanceCache.size());
+
+  if (count <= mSortedCount)
+    return;
+
+  // grow the sorted prefix at least geometrically, so that walking the cache stays O(n log n)
+  const size_t newSortedCount = std::min(mDistanceCache.size(), std::max(count, 2 * mSortedCount));
+  const auto sortedEnd = mDistanceCache.begin() + mSortedCount;
+  const auto newSortedEnd = mDistanceCache.begin() + newSortedCount;
+
+  if (newSortedEnd != mDistanceCache.end())
+    std::nth_element(sortedEnd, newSortedEnd, mDistanceCache.end());
+
+  std::sort(sortedEnd, newSortedEnd);
+  mSortedCount = newSortedCount;
+}
+
+void MTVRhythmSpace::QueryContext::ensureSortedPast(float squaredDistance)
+{
+  while (mSortedCount < mDistanceCache.size()
+    && (mSortedCount == 0 || mDistanceCache[mSortedCount - 1].squaredDistance <= squaredDistance)) {
+    ensureSorted(std::max(mSortedCount + 1, mSortedPrefixSize));
+  }
+}
 
 void computeMTV(
   const RhythmPattern & rhythm, 
@@ -184,12 +1371,20 @@ void computeMTV(
   Tension * mtvOut
 )
 {
-  MetricalSalience minSalience = salienceRange.first;
-  MetricalSalience maxSalience = salienceRange.second;
-  MetricalSalience salienceDelta = maxSalience - minSalience;
+  computeMTV(rhythm, rhythm.getMeterTables().getNaturalDurations(), prf, salienceRange, mtvOut);
+}
 
+void computeMTV(
+  const RhythmPattern & rhythm, 
+  const NaturalDurationTable & naturalDurations,
+  const MetricalSalienceProfile & prf, 
+  MetricalSalienceRange salienceRange,
+  Tension * mtvOut
+)
+{
   const int nSteps = rhythm.getNSteps();
-  const MusicalEventList& events = rhythm.asMusicalEvents();
+  MusicalEventBuffer events;
+  const int nEvents = rhythm.asMusicalEvents(events, naturalDurations);
   const MusicalEvent* currEvent = &events.front() - 1;  // one before first element
   const MusicalEvent* prevEvent = nullptr;
 
@@ -198,15 +1393,14 @@ void computeMTV(
 
   for (int pos = 0; pos < nSteps; ++pos) {
     if (pos > currEventEndPos) {
-      prevEvent = prevEvent ? currEvent : &events.back();
+      prevEvent = prevEvent ? currEvent : &events[nEvents - 1];
       currEventEndPos = (++currEvent)->getTrailingPosition();
 
       const int salience = currEvent->type == MusicalEventType::TIED_NOTE
         ? prf[prevEvent->position]
         : prf[currEvent->position];
 
-      const double relSalience = (double)(salience - minSalience) / salienceDelta;
-      currEventTension = (Tension)(1.0 - relSalience);
+      currEventTension = salienceToTension(salience, salienceRange);
     }
 
     mtvOut[pos] = currEventTension;
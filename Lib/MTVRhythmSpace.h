@@ -3,78 +3,405 @@
 #include "Types.h"
 #include "RhythmPattern.h"
 #include "TimeSignature.h"
+#include "MeterTables.h"
+#include "MTVBeatTable.h"
+#include "MTVBeatSearch.h"
+#include "MTVStaticMeter.h"
+#include "MTVBlockKernel.h"
+#include "MTVDistanceKernel.h"
+#include "MTVVPTree.h"
+#include "AliasTable.h"
+#include "MappedFile.h"
+#include "CancellationToken.h"
+#include <atomic>
+#include <cstdint>
+#include <memory>
 #include <mutex>
 #include <future>
 #include <vector>
 #include <random>
 #include <functional>
+#include <string>
+#include <cmath>
 
 #define MTV_RHYTHM_SPACE_RAND_SIGMA 0.0002
+#define MTV_RHYTHM_SPACE_POINT_ALIGNMENT 64  // alignment (in bytes) of the point buffer
+#define MTV_RHYTHM_SPACE_FILL_CHUNK_SIZE 4096  // number of patterns per fill() work item
+#define MTV_RHYTHM_SPACE_FILL_PROGRESS_STEPS 100  // max number of progress reports per fill()
+#define MTV_RHYTHM_SPACE_FILL_PROGRESS_INTERVAL_MS 10  // progress polling interval of a parallel fill()
+#define MTV_RHYTHM_SPACE_SORTED_PREFIX_SIZE 256  // default size of the sorted distance cache prefix
+#define MTV_RHYTHM_SPACE_DISTANCE_BLOCK_SIZE 1024  // number of points per distance kernel call
+#define MTV_RHYTHM_SPACE_MAX_INCREMENTAL_LEVELS 16  // max distinct tensions on the changed step for a single-step update
+#define MTV_RHYTHM_SPACE_ROOT_SALIENCE 0  // salience of the measure root (the max salience of the profile)
+#define MTV_RHYTHM_SPACE_MAX_MATERIALIZED_STEPS 31  // pattern indices and cache offsets are stored in 32 bits
+#define MTV_RHYTHM_SPACE_FILE_VERSION 1  // bump whenever the space file format or the mtv computation changes
 
 
 
 class MTVRhythmSpace
 {
 public: 
+  // memory layout of the point buffer
+  enum PointLayout {
+    ROW_MAJOR,    // the mtvs are stored one after the other (pattern by pattern)
+    COLUMN_MAJOR  // the tensions are stored step by step (all first steps, then all second steps, ...)
+  };
+
+  // how the tensions of the point buffer are stored
+  enum PointFormat {
+    FLOAT32,         // as Tension values
+    QUANTIZED_UINT8  // as uint8 tension levels (tensions only take salience delta + 1 distinct values), distances 
+                     // to targets on the level grid are computed in integers and ordered with a counting sort
+  };
+
+  // how queries are answered
+  enum QueryBackend {
+    MATERIALIZED,  // fill() computes all mtvs and queries scan them (limited to ~24 steps)
+    IMPLICIT       // fill() only builds the beat tables and queries search them (up to MAX_N_STEPS, 
+                   // getRandomPatternCloseTo and getMTV(PatternId) are not supported)
+  };
+
+  // how the distance cache is ordered after a distance scan
+  enum DistanceCacheMode {
+    FULL_SORT,    // the whole cache is sorted
+    PARTIAL_SORT  // only a prefix of the closest patterns is sorted, the (unsorted) tail is 
+                  // partitioned and sorted lazily when a query reaches past the prefix
+  };
+
+  // how the distances are keyed in a query context's distance cache
+  enum DistanceKeyFormat {
+    FLOAT_KEYS,   // squared distances, as 8-byte entries (float key + 32-bit pattern index), ordered by DistanceCacheMode
+    UINT16_KEYS,  // normalized distances quantized to 16 bits and counting sorted into a structure of arrays: the 
+                  // pattern indices in key order (4 bytes per pattern) and the first position of each key. The 
+                  // closest pattern is still exact (the closest key is refined), random picks are made in 
+                  // clusters of keys instead of exact distances (width 1/65535)
+    UINT8_KEYS    // same with 8-bit keys (clusters of width 1/255)
+  };
+
+  // a pattern and its (normalized) distance to a query target
+  struct Neighbour
+  {
+    PatternId patternId;
+    float distance;
+  };
+
+  // the number of patterns at one distance from a query target, and at that distance or closer
+  struct DistanceLevel
+  {
+    float distance;  // normalized
+    PatternId count;
+    PatternId cumulativeCount;
+  };
+
+  // Per-caller query state: the distance cache for the last queried target and the random generator 
+  // used for random picks. A filled space is never modified by queries, so any number of threads can 
+  // query the same space concurrently, as long as each uses its own context.
+  class QueryContext
+  {
+  public:
+    explicit QueryContext(
+      DistanceCacheMode mode = DistanceCacheMode::PARTIAL_SORT,
+      std::mt19937::result_type seed = std::mt19937::default_seed
+    );
+
+    inline DistanceCacheMode getDistanceCacheMode() const { return mMode; }
+    // sets the distance cache mode and the initial size of the sorted prefix (PARTIAL_SORT only)
+    void setDistanceCacheMode(DistanceCacheMode mode, size_t sortedPrefixSize = MTV_RHYTHM_SPACE_SORTED_PREFIX_SIZE);
+    inline DistanceKeyFormat getDistanceKeyFormat() const { return mKeyFormat; }
+    // sets how the distances are keyed (which invalidates the cache and releases the memory of the previous format)
+    void setDistanceKeyFormat(DistanceKeyFormat format);
+    // returns the memory (in bytes) reserved by the distance cache
+    size_t getMemorySize() const;
+    // reseeds the random generator
+    inline void seed(std::mt19937::result_type seed) { mRandom.seed(seed); }
+    // drops the distance cache, so that the next query re-scans the space
+    void invalidate();
+    // returns the number of queries since the last scan whose cache was updated from the previous target's (which 
+    // differed in one step) instead of re-scanning the space
+    inline int getIncrementalUpdateCount() const { return mNIncrementalUpdates; }
+
+  protected:
+    friend class MTVRhythmSpace;
+
+    // cache entries are ordered by squared (not normalized) distance, which gives the same order as 
+    // the normalized distance without computing a sqrt per pattern. Pattern ids are stored in 32 bits 
+    // (see MTV_RHYTHM_SPACE_MAX_MATERIALIZED_STEPS), which halves the entry size and the data moved by sorts.
+    struct DistanceCacheEntry
+    {
+      float squaredDistance;
+      uint32_t patternId;
+
+      friend bool operator<(const DistanceCacheEntry& lhs, const DistanceCacheEntry& rhs) {
+        if (lhs.squaredDistance == rhs.squaredDistance)
+          return lhs.patternId < rhs.patternId;
+        return lhs.squaredDistance < rhs.squaredDistance;
+      }
+
+      friend bool operator<(const DistanceCacheEntry& lhs, float rhs) {
+        return lhs.squaredDistance < rhs;
+      }
+
+      friend bool operator<(float lhs, const DistanceCacheEntry& rhs) {
+        return lhs < rhs.squaredDistance;
+      }
+    };
+
+    // returns whether the cache holds the distances of the given space to the given target
+    bool isCacheOf(const MTVRhythmSpace& space, const Tension * const mtv) const;
+    // returns the largest distance key (UINT16_KEYS and UINT8_KEYS only)
+    inline uint32_t getMaxKey() const { return mKeyFormat == DistanceKeyFormat::UINT8_KEYS ? UINT8_MAX : UINT16_MAX; }
+    // makes sure that at least the first count cache entries are sorted
+    void ensureSorted(size_t count);
+    // makes sure that the sorted cache prefix contains an entry farther than the given squared distance (or the whole cache)
+    void ensureSortedPast(float squaredDistance);
+
+  private:
+    DistanceCacheMode mMode;
+    DistanceKeyFormat mKeyFormat;
+    size_t mSortedPrefixSize;
+    size_t mSortedCount;  // cache entries [0, mSortedCount) are sorted, the rest isn't but is never closer
+    uint64_t mSpaceId;    // id of the space the cache was computed for (0 if none)
+    int mNIncrementalUpdates;  // number of single-step updates since the last full scan
+    std::vector<Tension> mTarget;
+    std::vector<DistanceCacheEntry> mDistanceCache;  // FLOAT_KEYS only
+    std::vector<uint32_t> mKeyPatterns;   // pattern ids ordered by (key, id), quantized keys only
+    std::vector<uint32_t> mKeyOffsets;    // position of the first pattern of each key in mKeyPatterns (+ end)
+    std::vector<uint16_t> mNonEmptyKeys;  // keys with at least one pattern, in increasing order
+    std::mt19937 mRandom;
+  };
+
+  // Lazily enumerates the patterns of a space by increasing distance to a target (ties by pattern id). 
+  // Construction scans the space and heapifies the distances in O(N), then each next() pops the heap 
+  // in O(log N), so only the consumed prefix gets ordered. The space must outlive the iterator.
+  class NeighbourIterator
+  {
+  public:
+    NeighbourIterator(const MTVRhythmSpace& space, const Tension * const mtv);
+
+    // writes the next closest pattern, returns false once all patterns have been enumerated
+    bool next(Neighbour& neighbourOut);
+    inline bool hasNext() const { return !mHeap.empty(); }
+    inline size_t getRemainingCount() const { return mHeap.size(); }
+
+  private:
+    // heap comparator, inverted as std heaps put the greatest element first
+    static inline bool isFarther(const QueryContext::DistanceCacheEntry& lhs, const QueryContext::DistanceCacheEntry& rhs) {
+      return rhs < lhs;
+    }
+
+    const MTVRhythmSpace& mSpace;
+    std::vector<QueryContext::DistanceCacheEntry> mHeap;  // min-heap of the patterns not enumerated yet
+  };
+
+  // Draws patterns for a fixed target and distance SD with the same distribution as getRandomPatternCloseTo, 
+  // in O(1) per draw. Construction scans and sorts the distances once and groups the patterns by distinct 
+  // distance level. A level is picked when the random distance falls in its interval (the distances closer 
+  // to it than to its neighbour levels), which has a probability given by the normal cdf (the last level 
+  // also gets the distances beyond 1.0). The levels are drawn from an alias table, then a pattern is picked 
+  // uniformly in the level. The space must outlive the sampler.
+  class DistanceSampler
+  {
+  public:
+    DistanceSampler(const MTVRhythmSpace& space, const Tension * const mtv, float distanceSD);
+
+    PatternId draw(std::mt19937& random) const;
+
+    inline size_t getLevelCount() const { return mLevelDistances.size(); }
+    inline float getLevelDistance(size_t level) const { return mLevelDistances[level]; }  // normalized
+    inline double getLevelProbability(size_t level) const { return mLevelTable.getProbability(level); }
+    inline size_t getLevelPatternCount(size_t level) const { return mLevelBegins[level + 1] - mLevelBegins[level]; }
+
+  private:
+    std::vector<PatternId> mPatterns;  // pattern ids, grouped by level (closest first)
+    std::vector<size_t> mLevelBegins;  // position of the first pattern of each level in mPatterns (+ end)
+    std::vector<float> mLevelDistances;
+    AliasTable mLevelTable;
+  };
+
   MTVRhythmSpace(
     const TimeSignature& ts = TimeSignature(4, 4),
-    UnitRef stepUnit = Unit::QUAVER
+    UnitRef stepUnit = Unit::QUAVER,
+    PointLayout layout = PointLayout::ROW_MAJOR,
+    QueryBackend backend = QueryBackend::MATERIALIZED,
+    PointFormat format = PointFormat::FLOAT32
   );
 
   virtual ~MTVRhythmSpace();
 
-  // computes and fills this space with mtv points for all possible rhythm 
-  // patterns with this space's time signature and step unit
-  void fill(std::function<void(double)> progressFuncCallback = nullptr);
+  // computes and fills this space with mtv points for all possible rhythm patterns with this space's 
+  // time signature and step unit. The patterns are split in chunks and computed on the given number of 
+  // worker threads (1 computes everything on the calling thread, 0 uses one per hardware thread). The 
+  // progress callback is always called from the calling thread, at most MTV_RHYTHM_SPACE_FILL_PROGRESS_STEPS times.
+  // The optional cancellation token is checked between chunks: once it's cancelled, fill() releases the 
+  // points, returns false and leaves the space not ready (it can be filled again later).
+  bool fill(std::function<void(double)> progressFuncCallback = nullptr, int nThreads = 1, 
+    const CancellationToken * cancellationToken = nullptr);
 
-  inline bool ready() const { return mReady; }  // returns whether fill() has already been called
-  const Tension * const getMTV(const PatternId) const; // returns the MTV for the given rhythm or nullptr
-  int getPatternCount() const;  // returns the number of rhythms in this space
+  // writes the points of this filled MATERIALIZED space to a versioned binary file (in native byte order). The 
+  // file is written to path + ".tmp" and renamed over path, throws a std::runtime_error if either step fails.
+  void save(const std::string& path) const;
+  // makes this space ready by memory-mapping a file written by save() instead of calling fill(). Returns false 
+  // (the space stays not ready) if the file can't be opened or was written for another space or file version.
+  bool open(const std::string& path);
+  // returns a file name for save() and open() made of the meter, step unit, salience parameters, layout and format
+  std::string getFileName() const;
+
+  inline bool ready() const { return mReady; }  // returns whether fill() or open() has already been called
+  const Tension * const getMTV(const PatternId) const; // returns the MTV for the given rhythm or nullptr (only for FLOAT32 ROW_MAJOR)
+  bool getMTV(const PatternId, Tension * mtvOut) const; // copies the MTV for the given rhythm, returns false if it doesn't exist
+  PatternId getPatternCount() const;  // returns the number of rhythms in this space
   int getDimensions() const;  // returns the number of dimensions
-  PatternId getClosestPattern(const Tension * const mtv); // returns the pattern whose mtv is closest to the given point
+  size_t getMemorySize() const;  // returns the size (in bytes) of the point buffer, once filled (or opened)
+  // returns the memory held by this space once it's ready (in bytes): the point buffer, the index and the 
+  // beat tables. Returns 0 while it's not ready, as nothing is held before fill() or open() completes.
+  size_t getTotalMemorySize() const;
+
+  // returns the pattern whose mtv is closest to the given point
+  PatternId getClosestPattern(const Tension * const mtv, QueryContext& ctx) const;
+  // returns a random pattern at a normally distributed distance from the given point
+  PatternId getRandomPatternCloseTo(const Tension * const mtv, QueryContext& ctx, float distanceSD = 0.1f) const;
+
+  // makes fill() and open() build a vantage-point tree over the points before the space becomes ready, which 
+  // then answers getClosestPattern (unless the context already holds the target's distances), getKNearest and 
+  // getWithinRadius without scanning the space, with the same results. Must be called before fill() or open(), 
+  // so that the index never changes while the space is queried. MATERIALIZED ROW_MAJOR FLOAT32 only, see 
+  // getIndex() for build time and memory size.
+  void enableIndex();
+  inline const MTVVPTree* getIndex() const { return mIndex.get(); }  // nullptr until the space is ready
+
+  // returns the k patterns closest to the given point (or all if there are less), closest first, with ties 
+  // ordered by pattern id. Keeps a bounded heap of k entries during one scan. MATERIALIZED only.
+  std::vector<Neighbour> getKNearest(const Tension * const mtv, size_t k) const;
+  // returns the patterns within the given (normalized) distance of the given point, closest first, with ties 
+  // ordered by pattern id. Only the matches are kept during the scan and sorted. MATERIALIZED only.
+  std::vector<Neighbour> getWithinRadius(const Tension * const mtv, float radius) const;
+
+  // returns the distinct (squared) distances of all patterns to the given point, closest first, with their 
+  // pattern counts and cumulative counts (the cdf). Distinct levels may normalize to the same distance. Computed in one streaming pass over the space, with 
+  // O(levels) memory and without building or sorting a distance cache. MATERIALIZED only.
+  std::vector<DistanceLevel> getDistanceHistogram(const Tension * const mtv) const;
+  // returns the number of patterns within the given (normalized) distance of the given point, in one 
+  // streaming pass (MATERIALIZED only)
+  PatternId countWithinDistance(const Tension * const mtv, float distance) const;
+  // returns the number of patterns within the given distance, looked up in a histogram in O(log levels)
+  static PatternId countWithinDistance(const std::vector<DistanceLevel>& histogram, float distance);
+
+  // returns an iterator over all patterns by increasing distance to the given point (MATERIALIZED only)
+  NeighbourIterator getNeighbours(const Tension * const mtv) const;
+  // returns a sampler for repeated random picks close to the given point (MATERIALIZED only)
+  DistanceSampler getDistanceSampler(const Tension * const mtv, float distanceSD = 0.1f) const;
+
+  // Batch queries, answered in one blocked pass over the space: each block of points is scored against 
+  // all targets while it's in cache. The targets are stored one after the other in mtvs (nTargets * 
+  // getDimensions() tensions) and one pattern per target is written to patternsOut.
+  void getClosestPatterns(const Tension * const mtvs, size_t nTargets, PatternId * patternsOut) const;
+  // Same picks as getRandomPatternCloseTo, with optional per-target distance SDs (distanceSD for all if nullptr) 
+  // and seeds (drawn from the context's generator if nullptr). The random distances are drawn before the pass 
+  // and the pattern is picked by reservoir sampling of its distance cluster, so the picks follow the same 
+  // distribution as getRandomPatternCloseTo's, but aren't the same ones. MATERIALIZED only.
+  void getRandomPatternsCloseTo(const Tension * const mtvs, size_t nTargets, PatternId * patternsOut, 
+    QueryContext& ctx, float distanceSD = 0.1f, const float * distanceSDs = nullptr, 
+    const std::mt19937::result_type * seeds = nullptr) const;
+
+  // same as above, using this space's own context (not thread-safe, use a QueryContext per thread instead)
+  PatternId getClosestPattern(const Tension * const mtv);
   PatternId getRandomPatternCloseTo(const Tension * const mtv, float distanceSD = 0.1f);
-  inline UnitRef getStepUnit() const { return mStepUnit; }
+
+  inline const UnitRef& getStepUnit() const { return mStepUnit; }
   inline const TimeSignature& getTimeSignature() const { return mTs; }
+  inline PointLayout getPointLayout() const { return mLayout; }
+  inline QueryBackend getQueryBackend() const { return mBackend; }
+  inline PointFormat getPointFormat() const { return mFormat; }
+  // sets the distance cache mode of this space's own context
+  inline void setDistanceCacheMode(DistanceCacheMode mode, size_t sortedPrefixSize = MTV_RHYTHM_SPACE_SORTED_PREFIX_SIZE) {
+    mDefaultContext.setDistanceCacheMode(mode, sortedPrefixSize);
+  }
+  inline const MTVBeatTable* getBeatTable() const { return mBeatTable.get(); }  // nullptr before fill()
+  // vectorized kernel over the beat table, nullptr before fill() or if the meter or the cpu doesn't support it
+  inline const MTVBlockKernel* getBlockKernel() const { return mBlockKernel.get(); }
   float getDistance(const Tension * const mtvA, const Tension * const mtvB) const;
 
 protected:
+  typedef QueryContext::DistanceCacheEntry DistanceCacheEntry;
 
+  void checkIfReady() const;
+  // computes the salience profile and the tables derived from it (level tensions, beat table and MTV kernels)
+  void setupSalience(MetricalSalienceProfile& prfOut, MetricalSalienceRange& rangeOut);
+  // scans the space and stores the distances to the given target in the context
+  void updateDistanceCache(const Tension * const mtv, QueryContext& ctx) const;
+  // updates the distances in the context if its target differs from the given one in exactly one step (and 
+  // re-sorts them as the cache mode requires), returns false (leaving the context untouched) otherwise
+  bool updateDistanceCacheIncrementally(const Tension * const mtv, QueryContext& ctx) const;
 
-  struct DistanceCacheEntry
-  {
-    float distanceToTarget;
-    PatternId patternId;
+  // scans the space and stores the quantized distance keys to the given target in the context (UINT16_KEYS and UINT8_KEYS)
+  void updateKeyedDistanceCache(const Tension * const mtv, QueryContext& ctx) const;
+  // returns the squared distance of the given pattern to the given point
+  float getSquaredDistance(const Tension * const mtv, PatternId patternId) const;
 
-    friend bool operator<(const DistanceCacheEntry& lhs, const DistanceCacheEntry& rhs) {
-      if (lhs.distanceToTarget == rhs.distanceToTarget)
-        return lhs.patternId < rhs.patternId;
-      return lhs.distanceToTarget < rhs.distanceToTarget;
-    }
+  // scans a QUANTIZED_UINT8 space and stores the distances to the given target in the (cleared) context cache, 
+  // returns true if the cache was fully sorted in the process
+  bool scanQuantizedPoints(const Tension * const mtv, QueryContext& ctx) const;
 
-    friend bool operator<(const DistanceCacheEntry& lhs, float rhs) {
-      return lhs.distanceToTarget < rhs;
-    }
+  // computes the squared distances of all targets block by block (see getClosestPatterns) and calls 
+  // onBlock(target index, first pattern id of the block, squared distances, count) for each block and target
+  void scanDistanceBlocks(const Tension * const mtvs, size_t nTargets, 
+    const std::function<void(size_t, PatternId, const float *, size_t)>& onBlock) const;
 
-    friend bool operator<(float lhs, const DistanceCacheEntry& rhs) {
-      return lhs < rhs.distanceToTarget;
-    }
-  };
+  // converts index matches to neighbours (normalizing their distances)
+  std::vector<Neighbour> toNeighbours(const std::vector<MTVVPTree::Match>& matches) const;
 
-  void checkIfReady() const;
-  void updateDistanceCache(const Tension * const mtv);
-  bool equalsDistanceCacheTargetPoint(const Tension * const mtv) const;
+  // converts a squared distance to a distance in [0, 1]
+  inline float normalizeSquaredDistance(float squaredDistance) const {
+    return (float)std::sqrt(squaredDistance) / (float)std::sqrt(mNSteps);
+  }
+
+  // returns the largest squared distance that normalizes to at most the given distance, so that filtering on 
+  // squared distances keeps exactly the patterns whose reported (normalized) distance is within it
+  float getMaxSquaredDistance(float distance) const;
+
+  // computes the mtvs of patterns [begin, end) with the given scratch pattern and buffer of MTV_BLOCK_KERNEL_N_LANES
+  // mtvs (the scratch pattern and the natural durations are only used when the meter can't be factorized with a 
+  // beat table)
+  void fillRange(PatternId begin, PatternId end, const MetricalSalienceProfile& prf, 
+    MetricalSalienceRange salienceRange, const NaturalDurationTable& naturalDurations, 
+    RhythmPattern& rp, Tension * mtvScratch);
+
+  // returns the index of the given pattern's step in the point buffer (see PointLayout)
+  inline size_t getPointIndex(PatternId patternId, int step) const {
+    return mLayout == PointLayout::ROW_MAJOR
+      ? (size_t)patternId * mNSteps + step
+      : (size_t)step * mNPoints + (size_t)patternId;
+  }
+
+  // returns the tension of the given pattern at the given step (no bound checks)
+  inline Tension getTension(PatternId patternId, int step) const {
+    return mFormat == PointFormat::FLOAT32
+      ? mPoints[getPointIndex(patternId, step)]
+      : mLevelTensions[mLevels[getPointIndex(patternId, step)]];
+  }
 
 private:
-  bool mReady;
+  const uint64_t mId;  // unique per space instance (never reused), identifies the space in query contexts
+  std::atomic<bool> mReady;  // set last by fill() and open(), the space is only read once it's ready
   const TimeSignature mTs;
   const UnitRef mStepUnit;
+  const PointLayout mLayout;
+  const QueryBackend mBackend;
+  const PointFormat mFormat;
+  MeterTablesRef mMeterTables;  // set up by fill() or open()
   const int mNSteps;
-  const int mNPoints;  // order is important (must go after mNSteps)
-  std::vector<Tension*> mPoints;
-  std::mt19937 mRandom;
-  //typedef std::pair<float, PatternId> DistanceCacheEntry;
-  std::vector<DistanceCacheEntry> mDistanceCache;
-  Tension * mDistanceCacheTargetPoint;
+  const PatternId mNPoints;  // order is important (must go after mNSteps)
+  Tension * mPoints;   // one aligned buffer of mNPoints * mNSteps tensions (see PointLayout), MATERIALIZED FLOAT32 only
+  uint8_t * mLevels;   // same as mPoints, but with tension levels, MATERIALIZED QUANTIZED_UINT8 only
+  std::vector<Tension> mLevelTensions;  // tension per level (level / salience delta)
+  std::unique_ptr<MTVBeatTable> mBeatTable;
+  StaticMTVKernel mStaticMTVKernel;  // compile-time specialization of computeMTV for this meter, or nullptr
+  std::unique_ptr<MTVBlockKernel> mBlockKernel;  // AVX2 only, computes the mtvs of fill() block by block
+  std::unique_ptr<MTVBeatSearch> mBeatSearch;  // IMPLICIT only
+  std::unique_ptr<MappedFile> mMappedFile;  // backs the point buffer if the space was open()ed
+  bool mIndexEnabled;  // see enableIndex()
+  std::unique_ptr<MTVVPTree> mIndex;
+  QueryContext mDefaultContext;
 };
 
 // Computes the metrical tension vector of a rhythm pattern, given a metrical salience profile and 
@@ -86,3 +413,21 @@ void computeMTV(
   MetricalSalienceRange salienceRange,
   Tension * mtvOut
 );
+
+// Same as above, with the given natural durations (usually the ones of the rhythm's meter tables), so that 
+// the conversion to musical events doesn't allocate (see RhythmPattern::asMusicalEvents).
+void computeMTV(
+  const RhythmPattern& rhythm,
+  const NaturalDurationTable& naturalDurations,
+  const MetricalSalienceProfile& prf,
+  MetricalSalienceRange salienceRange,
+  Tension * mtvOut
+);
+
+// Computes the metrical tension vector of a rhythm pattern by concatenating the rows of the given beat 
+// table. Gives the same result as computeMTV(const RhythmPattern&, ...) for the profile the table was 
+// built with, without converting the pattern to musical events. The table must be valid.
+inline void computeMTV(PatternId patternId, const MTVBeatTable& table, Tension * mtvOut)
+{
+  table.computeMTV(patternId, mtvOut);
+}
@@ -0,0 +1,68 @@
+#include "MTVRhythmSpaceRegistry.h"
+#include <algorithm>
+
+
+static bool spaceMatches(const MTVRhythmSpace& space, const TimeSignature& ts, UnitRef stepUnit)
+{
+  return space.getTimeSignature() == ts && *space.getStepUnit() == *stepUnit;
+}
+
+MTVRhythmSpaceRegistry::MTVRhythmSpaceRegistry(size_t memoryBudget) :
+  mMemoryBudget(memoryBudget)
+{
+}
+
+MTVRhythmSpaceRef MTVRhythmSpaceRegistry::get(const TimeSignature& ts, UnitRef stepUnit)
+{
+  auto it = std::find_if(mSpaces.begin(), mSpaces.end(), [&](const MTVRhythmSpaceRef& space) {
+    return spaceMatches(*space, ts, stepUnit);
+  });
+
+  if (it != mSpaces.end()) {
+    mSpaces.splice(mSpaces.begin(), mSpaces, it);
+  } else {
+    mSpaces.push_front(std::make_shared<MTVRhythmSpace>(ts, stepUnit));
+  }
+
+  evict();
+  return mSpaces.front();
+}
+
+MTVRhythmSpaceRef MTVRhythmSpaceRegistry::find(const TimeSignature& ts, UnitRef stepUnit) const
+{
+  for (const MTVRhythmSpaceRef& space : mSpaces) {
+    if (spaceMatches(*space, ts, stepUnit))
+      return space;
+  }
+
+  return nullptr;
+}
+
+void MTVRhythmSpaceRegistry::setMemoryBudget(size_t memoryBudget)
+{
+  mMemoryBudget = memoryBudget;
+  evict();
+}
+
+size_t MTVRhythmSpaceRegistry::getMemoryUsage() const
+{
+  size_t usage = 0;
+  for (const MTVRhythmSpaceRef& space : mSpaces)
+    usage += space->getTotalMemorySize();
+  return usage;
+}
+
+void MTVRhythmSpaceRegistry::clear()
+{
+  mSpaces.clear();
+}
+
+void MTVRhythmSpaceRegistry::evict()
+{
+  size_t usage = getMemoryUsage();
+
+  while (usage > mMemoryBudget && mSpaces.size() > 1) {
+    usage -= mSpaces.back()->getTotalMemorySize();
+    mSpaces.pop_back();
+  }
+}
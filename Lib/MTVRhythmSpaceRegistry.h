@@ -0,0 +1,44 @@
+#pragma once
+
+#include "MTVRhythmSpace.h"
+#include <list>
+#include <memory>
+
+#define MTV_RHYTHM_SPACE_REGISTRY_DEFAULT_BUDGET ((size_t)1 << 30)  // default memory budget (in bytes)
+
+typedef std::shared_ptr<MTVRhythmSpace> MTVRhythmSpaceRef;
+
+
+// Keeps the recently used rhythm spaces, keyed by time signature and step unit, so that switching back 
+// to a recent meter doesn't fill its space again. The memory of the ready spaces (see 
+// MTVRhythmSpace::getTotalMemorySize, spaces that aren't filled or opened yet hold none) is kept under a budget 
+// by evicting the least recently used spaces. An evicted space stays alive as long as it's referenced 
+// elsewhere. The distance caches of the query contexts belong to their callers and are outside the budget 
+// (see QueryContext::getMemorySize). Not thread-safe.
+class MTVRhythmSpaceRegistry
+{
+public:
+  explicit MTVRhythmSpaceRegistry(size_t memoryBudget = MTV_RHYTHM_SPACE_REGISTRY_DEFAULT_BUDGET);
+
+  // returns the space for the given time signature and step unit (which might not be filled yet), 
+  // creating it if there's none. The returned space becomes the most recently used one and the others 
+  // are evicted until the budget is met (the returned space is kept even if it exceeds the budget alone).
+  MTVRhythmSpaceRef get(const TimeSignature& ts, UnitRef stepUnit);
+  // returns the space for the given time signature and step unit, or nullptr (doesn't change the order)
+  MTVRhythmSpaceRef find(const TimeSignature& ts, UnitRef stepUnit) const;
+
+  // sets the memory budget (in bytes) and evicts spaces until it's met
+  void setMemoryBudget(size_t memoryBudget);
+  inline size_t getMemoryBudget() const { return mMemoryBudget; }
+  size_t getMemoryUsage() const;  // returns the total memory size of the registered (ready) spaces
+  inline size_t size() const { return mSpaces.size(); }  // returns the number of registered spaces
+  void clear();
+  // evicts the least recently used spaces until the budget is met, keeping at least the most recent one. Called 
+  // by get() and setMemoryBudget(), and to be called when a registered space becomes ready (fill() or open() 
+  // completed), as that's when it starts holding memory.
+  void evict();
+
+private:
+  size_t mMemoryBudget;
+  std::list<MTVRhythmSpaceRef> mSpaces;  // most recently used first
+};
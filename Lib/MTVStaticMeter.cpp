@@ -0,0 +1,31 @@
+#include "MTVStaticMeter.h"
+
+
+template <int Num, int Den>
+static StaticMTVKernel getStaticMTVKernel(int stepDenominator)
+{
+  switch (stepDenominator) {
+  case 16: return &MTVStaticMeter<Num, Den, 16>::computeMTV;
+  case 8: return &MTVStaticMeter<Num, Den, 8>::computeMTV;
+  default: return nullptr;
+  }
+}
+
+StaticMTVKernel getStaticMTVKernel(const TimeSignature& ts, UnitHandle stepUnit)
+{
+  if (!stepUnit.isValid() || stepUnit->getNumerator() != 1)
+    return nullptr;
+
+  const int num = ts.getNumerator();
+  const int den = ts.getDenominator();
+  const int stepDen = stepUnit->getDenominator();
+
+  if (num == 4 && den == 4)
+    return stepDen == 4 ? &MTVStaticMeter<4, 4, 4>::computeMTV : getStaticMTVKernel<4, 4>(stepDen);
+  if (num == 3 && den == 4)
+    return stepDen == 4 ? &MTVStaticMeter<3, 4, 4>::computeMTV : getStaticMTVKernel<3, 4>(stepDen);
+  if (num == 6 && den == 8)  // quarter steps are longer than the beat, not representable
+    return getStaticMTVKernel<6, 8>(stepDen);
+
+  return nullptr;
+}
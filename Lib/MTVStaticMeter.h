@@ -0,0 +1,230 @@
+#pragma once
+
+#include "Types.h"
+#include "TimeSignature.h"
+#include "Unit.h"
+#include "MTVBeatTable.h"
+#include <array>
+#include <utility>
+
+
+// Compile-time meter tables of a Num/Den meter in 1/StepDen steps: the same salience profile, natural durations 
+// (trimmed to the beat) and per-beat tension rows that MeterTables and MTVBeatTable build at runtime from the meter 
+// tree. With the step count and the tables as constants, computeMTV is a fixed sequence of row copies that the 
+// compiler unrolls. Only instantiated for the meters the app offers (see getStaticMTVKernel), all other meters go 
+// through the runtime path. The functions are recursive so that they stay valid constexpr for compilers without 
+// relaxed constexpr (MSVC 2015).
+template <int Num, int Den, int StepDen>
+class MTVStaticMeter
+{
+public:
+  static_assert(StepDen >= Den, "meter not representable in the step unit");
+
+  enum {
+    N_STEPS = Num * StepDen / Den,
+    N_STEPS_PER_BEAT = StepDen / Den,
+    N_BEATS = Num,
+    N_SLICES = 1 << N_STEPS_PER_BEAT,  // onset combinations of a beat
+    N_ROW_ENTRIES = N_BEATS * N_SLICES * N_STEPS_PER_BEAT
+  };
+
+  static_assert(N_STEPS > 1 && N_STEPS < MAX_N_STEPS, "unsupported number of steps");
+  static_assert(N_STEPS_PER_BEAT <= MTV_BEAT_TABLE_MAX_STEPS_PER_BEAT, "beat too long for per-beat tables");
+
+  // subdivision of a node of n steps (see TimeSignature::getHierarchicalMeterSubdivisions)
+  static constexpr int getSubdivision(int n) {
+    return (n * Den / StepDen > 1 ? n * Den / StepDen : n) % 2 == 0 ? 2 : 3;
+  }
+
+  // number of levels of the meter tree below a node of n steps
+  static constexpr int getNLevels(int n = N_STEPS) {
+    return n > 1 ? 1 + getNLevels(n / getSubdivision(n)) : 0;
+  }
+
+  // depth of the first node starting at the given step (the root has depth 0)
+  static constexpr int getDepth(int step) {
+    return getNodeDepth(step, N_STEPS, 0);
+  }
+
+  // natural duration of the given step, trimmed to the beat
+  static constexpr int getNaturalDuration(int step) {
+    return getNodeNaturalDuration(step, N_STEPS);
+  }
+
+  // longest natural duration not exceeding d (see NaturalDurationTable::fitting)
+  static constexpr int getFittingDuration(int d) {
+    return getNodeFittingDuration(d, N_STEPS);
+  }
+
+  // tension of an event at the given step, as salienceToTension computes it for the salience profile
+  static constexpr Tension getTension(int step) {
+    return (Tension)(1.0 - (double)(getNLevels() - getDepth(step)) / getNLevels());
+  }
+
+  static const std::array<Tension, N_STEPS> TENSIONS;
+  static const std::array<int8_t, N_STEPS> NATURAL_DURATIONS;
+  static const std::array<int8_t, N_STEPS + 1> FITTING_DURATIONS;
+
+  // Computes the MTV of the given pattern (N_STEPS tensions). Gives the same result as the runtime computeMTV.
+  static void computeMTV(PatternId patternId, Tension * mtvOut)
+  {
+    const int sliceMask = N_SLICES - 1;
+    Tension carry = MTV_BEAT_TABLE_NO_CARRY;
+    bool carriedIntoLastBeat = false;
+
+    for (int beat = 0; beat < N_BEATS; ++beat) {
+      const int slice = (int)(patternId >> (beat * N_STEPS_PER_BEAT)) & sliceMask;
+      const Tension * const row = &ROWS[((size_t)beat * N_SLICES + slice) * N_STEPS_PER_BEAT];
+      Tension * const mtv = mtvOut + beat * N_STEPS_PER_BEAT;
+
+      for (int pos = 0; pos < N_STEPS_PER_BEAT; ++pos)
+        mtv[pos] = row[pos];
+
+      // a leading rest becomes a tied note when the previous beat ends with a note
+      if (carry != MTV_BEAT_TABLE_NO_CARRY) {
+        for (int pos = 0; pos < FIRST_REST_LENGTHS[slice]; ++pos)
+          mtv[pos] = carry;
+      }
+
+      carriedIntoLastBeat = carry != MTV_BEAT_TABLE_NO_CARRY;
+      carry = CARRY_OUTS[beat * N_SLICES + slice];
+    }
+
+    // a leading rest of the measure is tied to the last event if that one sounds (cyclic)
+    const int firstSlice = (int)patternId & sliceMask;
+    const int lastSlice = (int)(patternId >> ((N_BEATS - 1) * N_STEPS_PER_BEAT)) & sliceMask;
+    const int wrapSounding = WRAP_SOUNDINGS[lastSlice];
+
+    if (FIRST_REST_LENGTHS[firstSlice] > 0 && (wrapSounding == 1 || (wrapSounding == 2 && carriedIntoLastBeat))) {
+      const Tension wrapTension = TENSIONS[(N_BEATS - 1) * N_STEPS_PER_BEAT + LAST_EVENT_STARTS[lastSlice]];
+      for (int pos = 0; pos < FIRST_REST_LENGTHS[firstSlice]; ++pos)
+        mtvOut[pos] = wrapTension;
+    }
+  }
+
+private:
+  static constexpr int trimToBeat(int n) {
+    return n < N_STEPS_PER_BEAT ? n : N_STEPS_PER_BEAT;
+  }
+
+  static constexpr int getNodeDepth(int step, int n, int depth) {
+    return step % n == 0 ? depth : getNodeDepth(step, n / getSubdivision(n), depth + 1);
+  }
+
+  static constexpr int getNodeNaturalDuration(int step, int n) {
+    return step % n == 0 ? trimToBeat(n) : getNodeNaturalDuration(step, n / getSubdivision(n));
+  }
+
+  static constexpr int getNodeFittingDuration(int d, int n) {
+    return d == 0 ? 0 : trimToBeat(n) <= d ? trimToBeat(n) : getNodeFittingDuration(d, n / getSubdivision(n));
+  }
+
+  // Events never cross a beat (durations are trimmed to it), and the steps of a beat have the same natural
+  // durations in every beat, so a beat is segmented the same way wherever it is. The functions below take 
+  // positions relative to the beat and the onsets of the beat (slice).
+
+  static constexpr bool hasOnset(int slice, int pos) {
+    return ((slice >> pos) & 1) != 0;
+  }
+
+  // distance to the next onset of the beat, or to the end of the beat if there's none
+  static constexpr int getDistToOnset(int slice, int pos, int next) {
+    return next >= N_STEPS_PER_BEAT || hasOnset(slice, next) ? next - pos : getDistToOnset(slice, pos, next + 1);
+  }
+
+  static constexpr int getEventLength(int slice, int lo) {
+    return getFittingDuration(getNaturalDuration(lo) < getDistToOnset(slice, lo, lo + 1)
+      ? getNaturalDuration(lo) : getDistToOnset(slice, lo, lo + 1));
+  }
+
+  // start of the event the given position belongs to
+  static constexpr int getEventStart(int slice, int pos, int lo = 0) {
+    return lo + getEventLength(slice, lo) > pos ? lo : getEventStart(slice, pos, lo + getEventLength(slice, lo));
+  }
+
+  // tension of the event at the given position of the beat, when the previous beat doesn't end with a note
+  static constexpr Tension getBeatTension(int beat, int slice, int pos) {
+    return hasOnset(slice, getEventStart(slice, pos)) || getEventStart(slice, pos) == 0
+      || !hasOnset(slice, getEventStart(slice, getEventStart(slice, pos) - 1))
+      ? getTension(beat * N_STEPS_PER_BEAT + getEventStart(slice, pos))
+      : getTension(beat * N_STEPS_PER_BEAT + getEventStart(slice, getEventStart(slice, pos) - 1));
+  }
+
+  // tension of the row entry at the given index of ROWS ([beat][slice][position])
+  static constexpr Tension getRowTension(int ix) {
+    return getBeatTension(ix / (N_SLICES * N_STEPS_PER_BEAT), ix / N_STEPS_PER_BEAT % N_SLICES, ix % N_STEPS_PER_BEAT);
+  }
+
+  static constexpr int getFirstRestLength(int slice) {
+    return hasOnset(slice, 0) ? 0 : getEventLength(slice, 0);
+  }
+
+  static constexpr int getLastEventStart(int slice) {
+    return getEventStart(slice, N_STEPS_PER_BEAT - 1);
+  }
+
+  // tension carried into the next beat if the beat ends with a note, for the given index of CARRY_OUTS ([beat][slice])
+  static constexpr Tension getCarryOut(int ix) {
+    return hasOnset(ix % N_SLICES, getLastEventStart(ix % N_SLICES))
+      ? getTension(ix / N_SLICES * N_STEPS_PER_BEAT + getLastEventStart(ix % N_SLICES))
+      : MTV_BEAT_TABLE_NO_CARRY;
+  }
+
+  // 1 if the last event sounds, 2 if it only sounds when carried into, 0 otherwise (see MTVBeatTable::Entry)
+  static constexpr int getWrapSounding(int slice) {
+    return hasOnset(slice, getLastEventStart(slice)) ? 1
+      : getLastEventStart(slice) == 0 ? 2
+      : hasOnset(slice, getEventStart(slice, getLastEventStart(slice) - 1)) ? 1 : 0;
+  }
+
+  template <typename T, typename ValueT, ValueT (*getValue)(int), size_t... Ix>
+  static constexpr std::array<T, sizeof...(Ix)> makeTable(std::index_sequence<Ix...>) {
+    return {{ (T)getValue((int)Ix)... }};
+  }
+
+  static const std::array<Tension, N_ROW_ENTRIES> ROWS;  // [beat][slice][position]
+  static const std::array<Tension, N_BEATS * N_SLICES> CARRY_OUTS;
+  static const std::array<int8_t, N_SLICES> FIRST_REST_LENGTHS;
+  static const std::array<int8_t, N_SLICES> LAST_EVENT_STARTS;
+  static const std::array<int8_t, N_SLICES> WRAP_SOUNDINGS;
+};
+
+template <int Num, int Den, int StepDen>
+const std::array<Tension, MTVStaticMeter<Num, Den, StepDen>::N_STEPS> MTVStaticMeter<Num, Den, StepDen>::TENSIONS =
+  makeTable<Tension, Tension, &MTVStaticMeter<Num, Den, StepDen>::getTension>(std::make_index_sequence<N_STEPS>());
+
+template <int Num, int Den, int StepDen>
+const std::array<int8_t, MTVStaticMeter<Num, Den, StepDen>::N_STEPS> MTVStaticMeter<Num, Den, StepDen>::NATURAL_DURATIONS =
+  makeTable<int8_t, int, &MTVStaticMeter<Num, Den, StepDen>::getNaturalDuration>(std::make_index_sequence<N_STEPS>());
+
+template <int Num, int Den, int StepDen>
+const std::array<int8_t, MTVStaticMeter<Num, Den, StepDen>::N_STEPS + 1> MTVStaticMeter<Num, Den, StepDen>::FITTING_DURATIONS =
+  makeTable<int8_t, int, &MTVStaticMeter<Num, Den, StepDen>::getFittingDuration>(std::make_index_sequence<N_STEPS + 1>());
+
+template <int Num, int Den, int StepDen>
+const std::array<Tension, MTVStaticMeter<Num, Den, StepDen>::N_ROW_ENTRIES> MTVStaticMeter<Num, Den, StepDen>::ROWS =
+  makeTable<Tension, Tension, &MTVStaticMeter<Num, Den, StepDen>::getRowTension>(std::make_index_sequence<N_ROW_ENTRIES>());
+
+template <int Num, int Den, int StepDen>
+const std::array<Tension, MTVStaticMeter<Num, Den, StepDen>::N_BEATS * MTVStaticMeter<Num, Den, StepDen>::N_SLICES> MTVStaticMeter<Num, Den, StepDen>::CARRY_OUTS =
+  makeTable<Tension, Tension, &MTVStaticMeter<Num, Den, StepDen>::getCarryOut>(std::make_index_sequence<N_BEATS * N_SLICES>());
+
+template <int Num, int Den, int StepDen>
+const std::array<int8_t, MTVStaticMeter<Num, Den, StepDen>::N_SLICES> MTVStaticMeter<Num, Den, StepDen>::FIRST_REST_LENGTHS =
+  makeTable<int8_t, int, &MTVStaticMeter<Num, Den, StepDen>::getFirstRestLength>(std::make_index_sequence<N_SLICES>());
+
+template <int Num, int Den, int StepDen>
+const std::array<int8_t, MTVStaticMeter<Num, Den, StepDen>::N_SLICES> MTVStaticMeter<Num, Den, StepDen>::LAST_EVENT_STARTS =
+  makeTable<int8_t, int, &MTVStaticMeter<Num, Den, StepDen>::getLastEventStart>(std::make_index_sequence<N_SLICES>());
+
+template <int Num, int Den, int StepDen>
+const std::array<int8_t, MTVStaticMeter<Num, Den, StepDen>::N_SLICES> MTVStaticMeter<Num, Den, StepDen>::WRAP_SOUNDINGS =
+  makeTable<int8_t, int, &MTVStaticMeter<Num, Den, StepDen>::getWrapSounding>(std::make_index_sequence<N_SLICES>());
+
+
+// MTV kernel of a meter specialization (see MTVStaticMeter::computeMTV)
+typedef void (*StaticMTVKernel)(PatternId patternId, Tension * mtvOut);
+
+// returns the MTV kernel specialized for the given meter (4/4, 3/4 and 6/8 in 1/16, 1/8 and 1/4 steps, when
+// representable), or nullptr if there's none and the runtime path must be used
+StaticMTVKernel getStaticMTVKernel(const TimeSignature& ts, UnitHandle stepUnit);
@@ -0,0 +1,170 @@
+#include "MTVVPTree.h"
+#include "MTVDistanceKernel.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <limits>
+#include <stdexcept>
+
+// relative slack of the pruning tests, so that float rounding never prunes a matching point
+#define MTV_VP_TREE_PRUNE_EPSILON 1e-5f
+
+
+MTVVPTree::MTVVPTree(const Tension * const points, PatternId nPoints, int nDims) :
+  mPoints(points),
+  mNPoints(nPoints),
+  mNDims(nDims),
+  // each squared difference is off by at most half a unit, which moves a distance by at most 
+  // sqrt(nDims / 2 / MTV_DISTANCE_UNITS), and pruning adds up three such distances
+  mRoundingSlack(3.0f * std::sqrt(0.5f * nDims / MTV_DISTANCE_UNITS)),
+  mBuildTime(0.0)
+{
+  if (nPoints > std::numeric_limits<uint32_t>::max())
+    throw std::runtime_error("MTVVPTree supports at most 2^32 - 1 points");
+
+  const auto startTime = std::chrono::steady_clock::now();
+
+  mIds.resize((size_t)nPoints);
+  mMedians.resize((size_t)nPoints);
+  for (size_t i = 0; i < mIds.size(); ++i)
+    mIds[i] = (uint32_t)i;
+
+  std::vector<Match> scratch;
+  scratch.reserve(mIds.size());
+  build(0, mIds.size(), scratch);
+
+  mBuildTime = std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+}
+
+void MTVVPTree::build(size_t begin, size_t end, std::vector<Match>& scratch)
+{
+  if (end - begin <= MTV_VP_TREE_LEAF_SIZE)
+    return;
+
+  // the middle point is used as vantage point (the ids are roughly shuffled by the parent partitions)
+  std::swap(mIds[begin], mIds[begin + (end - begin) / 2]);
+  const Tension * const vantagePoint = mPoints + (size_t)mIds[begin] * mNDims;
+
+  scratch.clear();
+  for (size_t i = begin + 1; i < end; ++i)
+    scratch.push_back({ getSquaredDistance(vantagePoint, mIds[i]), mIds[i] });
+
+  // split at the median: [begin + 1, mid) is inside (<= median), [mid, end) outside (>= median)
+  const size_t half = scratch.size() / 2;
+  std::nth_element(scratch.begin(), scratch.begin() + half, scratch.end());
+  mMedians[begin] = std::sqrt(scratch[half].squaredDistance);
+
+  const size_t mid = begin + 1 + half;
+  for (size_t i = 0; i < scratch.size(); ++i)
+    mIds[begin + 1 + i] = (uint32_t)scratch[i].patternId;
+
+  build(begin + 1, mid, scratch);
+  build(mid, end, scratch);
+}
+
+float MTVVPTree::getSquaredDistance(const Tension * const target, uint32_t pointIx) const
+{
+  float squaredDistance;
+  computeSquaredDistances(target, mPoints + (size_t)pointIx * mNDims, 1, mNDims, &squaredDistance);
+  return squaredDistance;
+}
+
+template <typename OnMatch>
+void MTVVPTree::search(const Tension * const target, size_t begin, size_t end, float& squaredTau, 
+  OnMatch& onMatch) const
+{
+  if (end - begin <= MTV_VP_TREE_LEAF_SIZE) {
+    for (size_t i = begin; i < end; ++i) {
+      const float squaredDistance = getSquaredDistance(target, mIds[i]);
+      if (squaredDistance <= squaredTau)
+        onMatch(Match{ squaredDistance, mIds[i] }, squaredTau);
+    }
+    return;
+  }
+
+  const float squaredDistance = getSquaredDistance(target, mIds[begin]);
+  if (squaredDistance <= squaredTau)
+    onMatch(Match{ squaredDistance, mIds[begin] }, squaredTau);
+
+  // only the pruning works on distances (the triangle inequality doesn't hold for squared ones)
+  const float distance = std::sqrt(squaredDistance);
+  const float median = mMedians[begin];
+  const size_t mid = begin + 1 + (end - begin - 1) / 2;
+
+  const float slack = MTV_VP_TREE_PRUNE_EPSILON * (distance + median) + mRoundingSlack;
+
+  // visit the side the target falls in first, as it's more likely to shrink tau (which is re-read 
+  // before visiting the other side)
+  if (distance <= median) {
+    if (distance - std::sqrt(squaredTau) - slack <= median)
+      search(target, begin + 1, mid, squaredTau, onMatch);
+    if (distance + std::sqrt(squaredTau) + slack >= median)
+      search(target, mid, end, squaredTau, onMatch);
+  } else {
+    if (distance + std::sqrt(squaredTau) + slack >= median)
+      search(target, mid, end, squaredTau, onMatch);
+    if (distance - std::sqrt(squaredTau) - slack <= median)
+      search(target, begin + 1, mid, squaredTau, onMatch);
+  }
+}
+
+std::vector<MTVVPTree::Match> MTVVPTree::findKNearest(const Tension * const target, size_t k) const
+{
+  k = (size_t)std::min((PatternId)k, mNPoints);
+  std::vector<Match> heap;  // max-heap of the k closest points so far
+  heap.reserve(k);
+
+  if (k == 0)
+    return heap;
+
+  float squaredTau = std::numeric_limits<float>::infinity();
+
+  auto onMatch = [&](const Match& match, float& squaredTau) {
+    if (heap.size() == k) {
+      if (!(match < heap.front())) return;
+      std::pop_heap(heap.begin(), heap.end());
+      heap.pop_back();
+    }
+
+    heap.push_back(match);
+    std::push_heap(heap.begin(), heap.end());
+
+    if (heap.size() == k)
+      squaredTau = heap.front().squaredDistance;
+  };
+
+  search(target, 0, mIds.size(), squaredTau, onMatch);
+  std::sort_heap(heap.begin(), heap.end());
+  return heap;
+}
+
+std::vector<MTVVPTree::Match> MTVVPTree::findWithinRadius(const Tension * const target, float squaredRadius) const
+{
+  std::vector<Match> matches;
+
+  auto onMatch = [&](const Match& match, float&) {
+    matches.push_back(match);
+  };
+
+  search(target, 0, mIds.size(), squaredRadius, onMatch);
+  std::sort(matches.begin(), matches.end());
+  return matches;
+}
+
+PatternId MTVVPTree::findClosest(const Tension * const target, float * squaredDistanceOut) const
+{
+  const std::vector<Match> nearest = findKNearest(target, 1);
+
+  if (nearest.empty())
+    return EMPTY_RHYTHM_PATTERN;
+
+  if (squaredDistanceOut)
+    *squaredDistanceOut = nearest.front().squaredDistance;
+
+  return nearest.front().patternId;
+}
+
+size_t MTVVPTree::getMemorySize() const
+{
+  return mIds.capacity() * sizeof(uint32_t) + mMedians.capacity() * sizeof(float);
+}
@@ -0,0 +1,61 @@
+#pragma once
+
+#include "Types.h"
+#include <vector>
+#include <cstdint>
+
+#define MTV_VP_TREE_LEAF_SIZE 16  // max number of points scanned linearly at the bottom of the tree
+
+
+// Vantage-point tree over a row-major buffer of mtvs, answering exact nearest, k-nearest and radius 
+// queries with triangle inequality pruning. Each node picks a vantage point and splits the remaining 
+// points of its range at their median distance to it, the tree is stored implicitly in a permutation 
+// of the point indices (plus one median per node). The points are referenced, not copied, so the 
+// buffer must outlive the tree. Matches are decided on squared (not normalized) distances computed by 
+// computeSquaredDistances, so they agree exactly with a scan of the points by the distance kernel.
+class MTVVPTree
+{
+public:
+  // a point index and its squared distance to a query target
+  struct Match
+  {
+    float squaredDistance;
+    PatternId patternId;
+
+    friend bool operator<(const Match& lhs, const Match& rhs) {
+      if (lhs.squaredDistance == rhs.squaredDistance)
+        return lhs.patternId < rhs.patternId;
+      return lhs.squaredDistance < rhs.squaredDistance;
+    }
+  };
+
+  MTVVPTree(const Tension * const points, PatternId nPoints, int nDims);
+
+  // returns the k points closest to the target, closest first, ties ordered by point index
+  std::vector<Match> findKNearest(const Tension * const target, size_t k) const;
+  // returns the points whose squared distance to the target is at most squaredRadius, closest first, ties 
+  // ordered by point index
+  std::vector<Match> findWithinRadius(const Tension * const target, float squaredRadius) const;
+  // returns the point closest to the target (lowest index on ties)
+  PatternId findClosest(const Tension * const target, float * squaredDistanceOut = nullptr) const;
+
+  inline double getBuildTime() const { return mBuildTime; }  // in seconds
+  size_t getMemorySize() const;  // returns the memory used by the tree (in bytes), without the points
+
+protected:
+  float getSquaredDistance(const Tension * const target, uint32_t pointIx) const;
+  void build(size_t begin, size_t end, std::vector<Match>& scratch);
+
+  // visits the node of range [begin, end), where squaredTau is the current squared search radius (updated by onMatch)
+  template <typename OnMatch>
+  void search(const Tension * const target, size_t begin, size_t end, float& squaredTau, OnMatch& onMatch) const;
+
+private:
+  const Tension * const mPoints;
+  const PatternId mNPoints;
+  const int mNDims;
+  const float mRoundingSlack;  // bound on the pruning error due to the rounding of the kernel's squared differences
+  std::vector<uint32_t> mIds;   // point indices, ordered by node: vantage point, inside range, outside range
+  std::vector<float> mMedians;  // median (not squared) distance to the vantage point of the node starting at each position
+  double mBuildTime;
+};
@@ -0,0 +1,77 @@
+#include "MappedFile.h"
+#include <stdexcept>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+
+MappedFile::MappedFile(const std::string& path) :
+  mData(nullptr),
+  mSize(0)
+{
+  char msg[300];
+
+#ifdef _WIN32
+  mFileHandle = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, 
+    OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+  mMappingHandle = nullptr;
+
+  LARGE_INTEGER size;
+  if (mFileHandle == INVALID_HANDLE_VALUE || !GetFileSizeEx(mFileHandle, &size) || size.QuadPart == 0) {
+    if (mFileHandle != INVALID_HANDLE_VALUE) CloseHandle(mFileHandle);
+    sprintf_s(msg, "can't open %s", path.c_str());
+    throw std::runtime_error(msg);
+  }
+
+  mSize = (size_t)size.QuadPart;
+  mMappingHandle = CreateFileMappingA(mFileHandle, nullptr, PAGE_READONLY, 0, 0, nullptr);
+  if (mMappingHandle)
+    mData = (const uint8_t*)MapViewOfFile(mMappingHandle, FILE_MAP_READ, 0, 0, 0);
+
+  if (!mData) {
+    if (mMappingHandle) CloseHandle(mMappingHandle);
+    CloseHandle(mFileHandle);
+    sprintf_s(msg, "can't map %s", path.c_str());
+    throw std::runtime_error(msg);
+  }
+#else
+  const int fd = ::open(path.c_str(), O_RDONLY);
+  struct stat st;
+
+  if (fd < 0 || fstat(fd, &st) != 0 || st.st_size == 0) {
+    if (fd >= 0) ::close(fd);
+    sprintf_s(msg, "can't open %s", path.c_str());
+    throw std::runtime_error(msg);
+  }
+
+  mSize = (size_t)st.st_size;
+  void * data = mmap(nullptr, mSize, PROT_READ, MAP_SHARED, fd, 0);
+  ::close(fd);  // the mapping keeps its own reference to the file
+
+  if (data == MAP_FAILED) {
+    sprintf_s(msg, "can't map %s", path.c_str());
+    throw std::runtime_error(msg);
+  }
+
+  mData = (const uint8_t*)data;
+#endif
+}
+
+MappedFile::~MappedFile()
+{
+#ifdef _WIN32
+  UnmapViewOfFile(mData);
+  CloseHandle(mMappingHandle);
+  CloseHandle(mFileHandle);
+#else
+  munmap((void*)mData, mSize);
+#endif
+}
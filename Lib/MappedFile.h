@@ -0,0 +1,28 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// Read-only memory mapping of a whole file, unmapped on destruction. The mapped address is page aligned.
+class MappedFile
+{
+public:
+  // maps the given file, throws a std::runtime_error if it can't be opened or mapped
+  explicit MappedFile(const std::string& path);
+  virtual ~MappedFile();
+
+  MappedFile(const MappedFile&) = delete;
+  MappedFile& operator=(const MappedFile&) = delete;
+
+  inline const uint8_t * getData() const { return mData; }
+  inline size_t getSize() const { return mSize; }
+
+private:
+  const uint8_t * mData;
+  size_t mSize;
+#ifdef _WIN32
+  void * mFileHandle;
+  void * mMappingHandle;
+#endif
+};
@@ -0,0 +1,87 @@
+#include "MeterTables.h"
+#include <algorithm>
+#include <map>
+#include <mutex>
+#include <stdexcept>
+#include <tuple>
+
+typedef std::tuple<int, int, int, int> MeterKey;  // numerator, denominator, step unit numerator and denominator
+
+static std::mutex& getCacheMutex()
+{
+  static std::mutex mutex;
+  return mutex;
+}
+
+static std::map<MeterKey, MeterTablesRef>& getCache()
+{
+  static std::map<MeterKey, MeterTablesRef> cache;
+  return cache;
+}
+
+
+MeterTables::MeterTables(const TimeSignature& ts, UnitHandle stepUnit) :
+  mTs(ts),
+  mStepUnit(stepUnit),
+  mNSteps(ts.getExactMeasureDuration(stepUnit)),
+  mNStepsPerBeat(ts.getBeatUnit()->convertExact(1, stepUnit)),
+  mSubdivisions(ts.getHierarchicalMeterSubdivisions(stepUnit)),
+  mSalienceProfile(ts.getMetricalSalienceProfile(stepUnit, 0)),
+  mTrimmedDurations(ts, stepUnit, true),
+  mDurations(ts, stepUnit, false)
+{
+}
+
+MeterTablesRef MeterTables::get(const TimeSignature& ts, UnitHandle stepUnit)
+{
+  const MeterKey key(ts.getNumerator(), ts.getDenominator(), stepUnit->getNumerator(), stepUnit->getDenominator());
+  std::lock_guard<std::mutex> lock(getCacheMutex());
+  std::map<MeterKey, MeterTablesRef>& cache = getCache();
+
+  auto it = cache.find(key);
+  if (it != cache.end() && it->second)
+    return it->second;
+
+  // built under the lock, which is only contended the first time a meter is used. Meters cached as 
+  // having no tables (see tryGet) are built again, so that they throw the same error.
+  MeterTablesRef tables(new MeterTables(ts, stepUnit));
+  cache[key] = tables;
+  return tables;
+}
+
+const MeterTables * MeterTables::tryGet(const TimeSignature& ts, UnitHandle stepUnit)
+{
+  const MeterKey key(ts.getNumerator(), ts.getDenominator(), stepUnit->getNumerator(), stepUnit->getDenominator());
+  std::lock_guard<std::mutex> lock(getCacheMutex());
+  std::map<MeterKey, MeterTablesRef>& cache = getCache();
+
+  auto it = cache.find(key);
+  if (it != cache.end())
+    return it->second.get();
+
+  MeterTablesRef tables;
+  try {
+    tables.reset(new MeterTables(ts, stepUnit));
+  } catch (const std::runtime_error&) {
+    // no tables for this meter, cached as nullptr
+  }
+
+  cache.emplace(key, tables);
+  return tables.get();
+}
+
+MetricalSalienceProfile MeterTables::getMetricalSalienceProfile(int rootWeight) const
+{
+  MetricalSalienceProfile prf(mSalienceProfile);
+  for (MetricalSalience& salience : prf)
+    salience += rootWeight;
+  return prf;
+}
+
+size_t MeterTables::getCacheSize()
+{
+  std::lock_guard<std::mutex> lock(getCacheMutex());
+  const std::map<MeterKey, MeterTablesRef>& cache = getCache();
+  return (size_t)std::count_if(cache.begin(), cache.end(), 
+    [](const std::pair<const MeterKey, MeterTablesRef>& entry) { return (bool)entry.second; });
+}
@@ -0,0 +1,73 @@
+#pragma once
+
+#include "TimeSignature.h"
+#include "Unit.h"
+#include <memory>
+
+typedef std::shared_ptr<const class MeterTables> MeterTablesRef;
+
+
+// natural durations of a meter in a given step unit, computed once for the allocation-free asMusicalEvents
+struct NaturalDurationTable
+{
+  NaturalDurationsList durations;  // natural duration per step
+  NaturalDurationsList pool;       // distinct natural durations, longest first (the last one is 1)
+  NaturalDurationsList fitting;    // longest pool duration not exceeding d, for d in [0, number of steps]
+
+  NaturalDurationTable(const TimeSignature& ts, UnitHandle stepUnit, bool trimDurationsToBeat = true)
+  {
+    durations = ts.getNaturalDurationsMap(stepUnit, trimDurationsToBeat, &pool);
+    fitting.resize(durations.size() + 1, 0);
+
+    for (size_t d = 1; d < fitting.size(); ++d) {
+      for (int8_t duration : pool) {
+        if (duration <= (int)d) {
+          fitting[d] = duration;
+          break;
+        }
+      }
+    }
+  }
+};
+
+// Immutable tables derived from the meter tree of a time signature in a step unit. They're built once per
+// (numerator, denominator, step unit) and shared process-wide through get(), so that patterns and spaces
+// of the same meter don't walk the meter tree again. Tables are never released, so plain pointers to 
+// them stay valid for the lifetime of the process.
+class MeterTables
+{
+public:
+  // returns the tables of the given meter, building them on first use (thread-safe). Throws if the
+  // meter isn't representable in the step unit or can't be subdivided hierarchically.
+  static MeterTablesRef get(const TimeSignature& ts, UnitHandle stepUnit);
+  // same as above, but returns nullptr (without throwing) for meters that have no tables, such as the 
+  // context-sensitive ones. The failure is cached as well, so it's only computed once per meter.
+  static const MeterTables * tryGet(const TimeSignature& ts, UnitHandle stepUnit);
+  // returns the number of meters whose tables have been built
+  static size_t getCacheSize();
+
+  inline const TimeSignature& getTimeSignature() const { return mTs; }
+  inline UnitHandle getStepUnit() const { return mStepUnit; }
+  inline int getNSteps() const { return mNSteps; }
+  inline int getNStepsPerBeat() const { return mNStepsPerBeat; }
+  inline const MeterSubdivisionList& getSubdivisions() const { return mSubdivisions; }
+  // salience profile with a root weight of 0 (the salience of a step for another root weight is offset by it)
+  inline const MetricalSalienceProfile& getMetricalSalienceProfile() const { return mSalienceProfile; }
+  // returns a copy of the salience profile for the given root weight
+  MetricalSalienceProfile getMetricalSalienceProfile(int rootWeight) const;
+  inline const NaturalDurationTable& getNaturalDurations(bool trimToBeat = true) const {
+    return trimToBeat ? mTrimmedDurations : mDurations;
+  }
+
+private:
+  MeterTables(const TimeSignature& ts, UnitHandle stepUnit);
+
+  const TimeSignature mTs;
+  const UnitHandle mStepUnit;
+  const int mNSteps;
+  const int mNStepsPerBeat;
+  const MeterSubdivisionList mSubdivisions;
+  const MetricalSalienceProfile mSalienceProfile;
+  const NaturalDurationTable mTrimmedDurations;
+  const NaturalDurationTable mDurations;
+};
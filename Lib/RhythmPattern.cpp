@@ -1,19 +1,24 @@
 #include "RhythmPattern.h"
+#include "Utils.h"
 #include <stdexcept>
+#include <algorithm>
 #include <assert.h>
+#include <type_traits>
 
-RhythmPattern::RhythmPattern(const TimeSignature& ts, UnitRef stepUnit, PatternId pattern) : 
+static_assert(std::is_trivially_copyable<RhythmPattern>::value, "RhythmPattern must be trivially copyable");
+
+RhythmPattern::RhythmPattern(const TimeSignature& ts, UnitHandle stepUnit, PatternId pattern) : 
   mTs(ts),
   mStepUnit(stepUnit),
+  mMeterTables(nullptr),
   mNSteps(ts.getExactMeasureDuration(stepUnit)),
   mPattern(std::bitset<MAX_N_STEPS>(pattern))
 {
   ts.checkStepUnit(stepUnit);
   checkNSteps();
+  mMeterTables = MeterTables::tryGet(ts, stepUnit);
 }
 
-RhythmPattern::~RhythmPattern() { }
-
 PatternId RhythmPattern::vector2PatternId(std::vector<bool> patternVec)
 {
   assert(patternVec.size() <= MAX_N_STEPS);
@@ -79,65 +84,78 @@ void RhythmPattern::setPatternId(PatternId pattern)
   mPattern = std::bitset<MAX_N_STEPS>(pattern);
 }
 
+const MeterTables& RhythmPattern::getMeterTables() const
+{
+  // meters without tables can still hold patterns, the error is only raised when the tables are needed
+  if (!mMeterTables)
+    return *MeterTables::get(mTs, mStepUnit);
+
+  return *mMeterTables;
+}
+
 std::vector<MusicalEvent> RhythmPattern::asMusicalEvents(bool cyclic, bool trimDurationsToBeat) const
 {
-  std::vector<MusicalEvent> events;
-  events.reserve(mNSteps);
+  MusicalEventBuffer events;
+  const int nEvents = asMusicalEvents(events, getMeterTables().getNaturalDurations(trimDurationsToBeat), cyclic);
+  return std::vector<MusicalEvent>(events.begin(), events.begin() + nEvents);
+}
 
-  NaturalDurationsList durPool;
-  const auto& naturalDurMap = mTs.getNaturalDurationsMap(
-    mStepUnit, trimDurationsToBeat, &durPool);
-  assert(naturalDurMap.size() == mNSteps);
-  assert(durPool.back() == 1);
+int RhythmPattern::asMusicalEvents(MusicalEventBuffer& events, const NaturalDurationTable& naturalDurations, bool cyclic) const
+{
+  return segmentPattern(getPatternId(), mNSteps, naturalDurations, events, cyclic);
+}
 
-  size_t lo = 0;
-  size_t hi = 0;
-  MusicalEventType eTypePrev = MusicalEventType::REST;
+int RhythmPattern::segmentPattern(PatternId patternId, int nSteps, const NaturalDurationTable& naturalDurations, 
+  MusicalEventBuffer& events, bool cyclic)
+{
+  const NaturalDurationsList& naturalDurMap = naturalDurations.durations;
+  const NaturalDurationsList& fittingDurs = naturalDurations.fitting;
+  assert(naturalDurMap.size() == (size_t)nSteps);
+  assert(fittingDurs.size() == (size_t)nSteps + 1);
 
-  while ((int)(lo = hi) < mNSteps) {
-    auto revDurIter = durPool.rbegin(); // starts at dur 1
-    const size_t naturalDur = naturalDurMap[lo];
-    const size_t maxEventEndPos = lo + naturalDur;
+  if (nSteps < MAX_N_STEPS)
+    patternId &= ((PatternId)1 << nSteps) - 1;
 
-    // move hi by largest duration from pool without crossing an onset
-    for (size_t tmpHi = lo + 1; tmpHi <= maxEventEndPos; ++tmpHi) {
+  // events never cross the end of the measure, where only an onset on the first step can stop them
+  const bool firstStepOnset = (patternId & 1) != 0;
+  int nEvents = 0;
+  int lo = 0;
+  MusicalEventType eTypePrev = MusicalEventType::REST;
 
-      // it may get to rend() but then s <= maxEventEndPos will be false and 
-      // the program shouldn't reach this iteration (in the for-loop)
-      assert(revDurIter != durPool.rend());
+  while (lo < nSteps) {
+    const bool onset = ((patternId >> lo) & 1) != 0;
 
-      // move hi only if it results in a valid natural duration
-      if (tmpHi - lo == *revDurIter) {
-        hi = tmpHi;
-        ++revDurIter;
-      }
+    // distance to the next onset (or past the end of the measure if there's none)
+    const PatternId nextOnsets = lo + 1 < MAX_N_STEPS ? patternId >> (lo + 1) : 0;
+    const int distToOnset = nextOnsets
+      ? countTrailingZeros(nextOnsets) + 1
+      : (firstStepOnset ? nSteps - lo : nSteps);
 
-      // break if next step contains an onset
-      if (mPattern[tmpHi % mNSteps]) break;
-    }
+    const int maxDur = std::min((int)naturalDurMap[lo], distToOnset);
+    const int dur = fittingDurs[maxDur];
 
     // note if onset. if no onset, tied note if preceded with onset; rest otherwise
-    const MusicalEventType eTypeCurr = mPattern[lo]
+    const MusicalEventType eTypeCurr = onset
       ? MusicalEventType::NOTE
       : (eTypePrev == MusicalEventType::NOTE
         ? MusicalEventType::TIED_NOTE
         : MusicalEventType::REST);
 
-    events.push_back({ eTypeCurr, (int)lo, (int)(hi - lo) });
+    events[nEvents++] = { eTypeCurr, lo, dur };
     eTypePrev = eTypeCurr;
+    lo += dur;
   }
 
   // convert heading rest to tied note in cyclic
   if (cyclic) {
-    const MusicalEvent& last = events.back();
-    MusicalEvent& first = events.front();
+    const MusicalEvent& last = events[nEvents - 1];
+    MusicalEvent& first = events[0];
     
     if (first.type == MusicalEventType::REST && last.type != MusicalEventType::REST)
       first.type = MusicalEventType::TIED_NOTE;
   }
 
-  events.shrink_to_fit();
-  return events;
+  return nEvents;
 }
 
 void RhythmPattern::reset()
@@ -150,17 +168,18 @@ void RhythmPattern::reset(const TimeSignature& ts)
   reset(ts, mStepUnit);
 }
 
-void RhythmPattern::reset(UnitRef stepUnit)
+void RhythmPattern::reset(UnitHandle stepUnit)
 {
   reset(mTs, stepUnit);
 }
 
-void RhythmPattern::reset(const TimeSignature & ts, UnitRef stepUnit)
+void RhythmPattern::reset(const TimeSignature & ts, UnitHandle stepUnit)
 {
   ts.checkStepUnit(stepUnit);
   mTs = ts;
   mStepUnit = stepUnit;
   updateNSteps();
+  mMeterTables = MeterTables::tryGet(ts, stepUnit);
   mPattern.reset();
 }
 
@@ -1,10 +1,12 @@
 #pragma once
 
+#include <array>
 #include <bitset>
 #include <vector>
 #include "Types.h"
 #include "Unit.h"
 #include "TimeSignature.h"
+#include "MeterTables.h"
 
 enum MusicalEventType {
   NOTE = 1,
@@ -18,11 +20,11 @@ struct MusicalEvent
   int position;
   int duration;
 
+  MusicalEvent() :
+    type(MusicalEventType::REST), position(0), duration(0) {}
+
   MusicalEvent(MusicalEventType type, int position, int duration) :
     type(type), position(position), duration(duration) {}
-  
-  MusicalEvent(const MusicalEvent &other) :
-    type(other.type), position(other.position), duration(other.duration) {}
 
   inline int getTrailingPosition() const { return position + duration - 1; }
 
@@ -35,18 +37,19 @@ struct MusicalEvent
 
 class RhythmPattern;
 typedef std::vector<MusicalEvent> MusicalEventList;
+typedef std::array<MusicalEvent, MAX_N_STEPS> MusicalEventBuffer;  // large enough for the events of any pattern
 typedef std::shared_ptr<class RhythmPattern> RhythmPatternRef;
 
-// monophonic rhythm with a duration of one measure
+// monophonic rhythm with a duration of one measure. Trivially copyable, so patterns can be copied in bulk 
+// (or handed over to another thread) without any reference counting.
 class RhythmPattern
 {
 public:
   explicit RhythmPattern(
     const TimeSignature& ts = TimeSignature(4, 4),
-    UnitRef stepUnit = Unit::QUAVER, 
+    UnitHandle stepUnit = Unit::QUAVER, 
     PatternId pattern = EMPTY_RHYTHM_PATTERN  // NOTE: LSB in pattern id represents first step (so, pattern from right to left)
   );
-  virtual ~RhythmPattern();
 
   // converts the given binary pattern to a pattern id (vector must have a size less than MAX_N_STEPS)
   static PatternId vector2PatternId(std::vector<bool> patternVec);
@@ -60,9 +63,9 @@ public:
   // set time signature and clear all onsets
   void reset(const TimeSignature& ts);
   // set step unit and clear all onsets
-  void reset(UnitRef stepUnit);
+  void reset(UnitHandle stepUnit);
   // set time signature and step unit and clear all onsets
-  void reset(const TimeSignature& ts, UnitRef stepUnit);
+  void reset(const TimeSignature& ts, UnitHandle stepUnit);
   // updates the steps in this rhythm pattern according to the given id
   void update(PatternId patternId);
   // set the given step (true for onset, false for rest)
@@ -81,11 +84,23 @@ public:
   PatternId getPatternId() const;
   // converts this rhythm pattern to musical events (notes, rests and tied notes) and returns the events as a vector
   std::vector<MusicalEvent> asMusicalEvents(bool cyclic = true, bool trimDurationsToBeat = true) const;
+  // same as above without any heap allocation: writes the events to the given buffer and returns their count. The 
+  // natural durations must have been computed for this pattern's time signature and step unit.
+  int asMusicalEvents(MusicalEventBuffer& eventsOut, const NaturalDurationTable& naturalDurations, bool cyclic = true) const;
+
+  // Converts the given pattern of nSteps steps to musical events, working on the pattern id directly: each event 
+  // lasts the longest pool duration that fits both its natural duration and the distance to the next onset, 
+  // which is found with count-trailing-zeros. Runs in O(events) instead of O(steps * pool size). Returns the 
+  // number of events written to eventsOut.
+  static int segmentPattern(PatternId patternId, int nSteps, const NaturalDurationTable& naturalDurations, 
+    MusicalEventBuffer& eventsOut, bool cyclic = true);
   
   // getters
   inline int getNSteps() const { return mNSteps; }
   inline const TimeSignature& getTimeSignature() const { return mTs; }
-  inline UnitRef getStepUnit() const { return mStepUnit; }
+  inline UnitHandle getStepUnit() const { return mStepUnit; }
+  // returns the tables shared by all patterns of this meter, throws if the meter has none (see MeterTables::tryGet)
+  const MeterTables& getMeterTables() const;
 
 protected:
   void checkStepIndex(size_t index) const;
@@ -94,7 +109,9 @@ protected:
 
 private:
   TimeSignature mTs;
-  UnitRef mStepUnit;
+  UnitHandle mStepUnit;
+  const MeterTables * mMeterTables;  // interned (see MeterTables::tryGet), so it's not reference counted. nullptr 
+                                     // for meters without tables (e.g. context-sensitive ones)
   int mNSteps;
   std::bitset<MAX_N_STEPS> mPattern;
 };
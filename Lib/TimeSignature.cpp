@@ -3,9 +3,12 @@
 #include <stdexcept>
 #include <assert.h>
 #include <algorithm>
+#include <type_traits>
 
 using namespace std::placeholders;
 
+static_assert(std::is_trivially_copyable<TimeSignature>::value, "TimeSignature must be trivially copyable");
+
 TimeSignature::TimeSignature() : TimeSignature(4, 4)
 {
 }
@@ -15,24 +18,24 @@ TimeSignature::TimeSignature(int numerator, int denominator) :
   mDenominator(denominator),
   mBeatUnit(Unit::get(denominator))
 {
-  if (!mBeatUnit) {
+  if (!mBeatUnit.isValid()) {
     char msg[64];
     sprintf_s(msg, "illegal time signature denominator %d", denominator);
     throw std::runtime_error(msg);
   }
 }
 
-double TimeSignature::getMeasureDuration(UnitRef unit) const
+double TimeSignature::getMeasureDuration(UnitHandle unit) const
 {
   return mBeatUnit->convert(mNumerator, unit);
 }
 
-int TimeSignature::getExactMeasureDuration(UnitRef unit) const
+int TimeSignature::getExactMeasureDuration(UnitHandle unit) const
 {
   return mBeatUnit->convertExact(mNumerator, unit);
 }
 
-MeterSubdivisionList TimeSignature::getHierarchicalMeterSubdivisions(UnitRef stepUnit) const
+MeterSubdivisionList TimeSignature::getHierarchicalMeterSubdivisions(UnitHandle stepUnit) const
 {
   checkStepUnit(stepUnit);
   MeterSubdivisionList subdivisions;
@@ -62,14 +65,14 @@ MeterSubdivisionList TimeSignature::getHierarchicalMeterSubdivisions(UnitRef ste
   return subdivisions;
 }
 
-MetricalSalienceProfile TimeSignature::getMetricalSalienceProfile(UnitRef stepUnit, int rootWeight) const
+MetricalSalienceProfile TimeSignature::getMetricalSalienceProfile(UnitHandle stepUnit, int rootWeight) const
 {
   return createMeterMap<int8_t>(stepUnit, [rootWeight](const MeterTreeNodeInfo& node) -> int8_t {
     return rootWeight - node.depth;
   });
 }
 
-NaturalDurationsList TimeSignature::getNaturalDurationsMap(UnitRef stepUnit, bool trimToBeat, NaturalDurationsList* naturalDurationsPoolOut) const
+NaturalDurationsList TimeSignature::getNaturalDurationsMap(UnitHandle stepUnit, bool trimToBeat, NaturalDurationsList* naturalDurationsPoolOut) const
 {
   const int nStepsPerBeat = mBeatUnit->convertExact(1, stepUnit);
   
@@ -87,7 +90,7 @@ NaturalDurationsList TimeSignature::getNaturalDurationsMap(UnitRef stepUnit, boo
   return naturalDurationsMap;
 }
 
-void TimeSignature::checkStepUnit(UnitRef stepUnit) const
+void TimeSignature::checkStepUnit(UnitHandle stepUnit) const
 {
   if ((*stepUnit) > (*mBeatUnit)) {
     char msg[114];
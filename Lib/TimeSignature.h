@@ -25,26 +25,26 @@ struct MeterTreeNodeInfo
     depth(depth), nSiblings(nSiblings), nNodesOnSameLevel(nNodesOnSameLevel), treeWidth(treeWidth), treeHeight(treeHeight) {}
 };
 
+// time signature, stored by value (trivially copyable, so it's copied without reference counting)
 class TimeSignature
 {
 public:
   TimeSignature();
   TimeSignature(int numerator, int denominator);
-  virtual ~TimeSignature() {}
 
   inline int getNumerator() const { return mNumerator; }
   inline int getDenominator() const { return mDenominator; }
-  inline UnitRef getBeatUnit() const { return mBeatUnit; }
+  inline UnitHandle getBeatUnit() const { return mBeatUnit; }
 
-  double getMeasureDuration(UnitRef unit) const;
-  int getExactMeasureDuration(UnitRef unit) const;
+  double getMeasureDuration(UnitHandle unit) const;
+  int getExactMeasureDuration(UnitHandle unit) const;
 
-  MeterSubdivisionList getHierarchicalMeterSubdivisions(UnitRef stepUnit) const;
-  MetricalSalienceProfile getMetricalSalienceProfile(UnitRef stepUnit, int rootWeight = 0) const;
-  NaturalDurationsList getNaturalDurationsMap(UnitRef stepUnit, bool trimToBeat = true, 
+  MeterSubdivisionList getHierarchicalMeterSubdivisions(UnitHandle stepUnit) const;
+  MetricalSalienceProfile getMetricalSalienceProfile(UnitHandle stepUnit, int rootWeight = 0) const;
+  NaturalDurationsList getNaturalDurationsMap(UnitHandle stepUnit, bool trimToBeat = true, 
     NaturalDurationsList* naturalDurationsOut = nullptr) const;
 
-  void checkStepUnit(UnitRef unit) const;
+  void checkStepUnit(UnitHandle unit) const;
 
   inline bool operator==(const TimeSignature &other) const 
   {
@@ -54,7 +54,7 @@ public:
 protected:
   template <typename T>
   inline std::vector<T> createMeterMap(
-    UnitRef stepUnit,
+    UnitHandle stepUnit,
     std::function<T(const MeterTreeNodeInfo& node)> getValue,
     std::vector<T>* valuesPerLevelOut = nullptr
   ) const
@@ -109,5 +109,5 @@ protected:
 private:
   int mNumerator;
   int mDenominator;
-  UnitRef mBeatUnit;
+  UnitHandle mBeatUnit;
 };
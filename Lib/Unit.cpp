@@ -1,5 +1,6 @@
 #include "Unit.h"
 #include <assert.h>
+#include <type_traits>
 
 const UnitRef Unit::SEMIQUAVER = UnitRef(new Unit(16));
 const UnitRef Unit::QUAVER = UnitRef(new Unit(8));
@@ -7,6 +8,32 @@ const UnitRef Unit::CROTCHET = UnitRef(new Unit(4));
 const UnitRef Unit::MINIM = UnitRef(new Unit(2));
 const UnitRef Unit::SEMIBREVE = UnitRef(new Unit(1));
 
+// indexed by log2(denominator)
+static const UnitRef* const sInternedUnits[UNIT_N_INTERNED] = {
+  &Unit::SEMIBREVE, &Unit::MINIM, &Unit::CROTCHET, &Unit::QUAVER, &Unit::SEMIQUAVER
+};
+
+static_assert(std::is_trivially_copyable<UnitHandle>::value, "UnitHandle must be trivially copyable");
+
+
+UnitHandle::UnitHandle(const UnitRef& unit) :
+  mIx(UNIT_HANDLE_INVALID)
+{
+  if (!unit || unit->getNumerator() != 1) return;
+
+  for (int ix = 0; ix < UNIT_N_INTERNED; ++ix) {
+    if ((1 << ix) == unit->getDenominator()) {
+      mIx = (uint8_t)ix;
+      return;
+    }
+  }
+}
+
+UnitRef UnitHandle::getRef() const
+{
+  return isValid() ? *sInternedUnits[mIx] : UnitRef(nullptr);
+}
+
 Unit::Unit(int numerator, int denominator) : 
   mNumerator(numerator),
   mDenominator(denominator),
@@ -47,12 +74,18 @@ UnitRef Unit::get(int denominator)
   return Unit::get(1, denominator);
 }
 
-double Unit::convert(double value, UnitRef toUnit) const
+const Unit& Unit::getInterned(int ix)
+{
+  assert(ix >= 0 && ix < UNIT_N_INTERNED);
+  return **sInternedUnits[ix];
+}
+
+double Unit::convert(double value, UnitHandle toUnit) const
 {
   return value * (double)mInAtoms / toUnit->mInAtoms;
 }
 
-int Unit::convertExact(int value, UnitRef toUnit) const
+int Unit::convertExact(int value, UnitHandle toUnit) const
 {
   return value * mInAtoms / toUnit->mInAtoms;
 }
@@ -1,11 +1,38 @@
 #pragma once
 
 #include <memory>
+#include <cstdint>
 
 #define UNIT_ATOM_SIZE 128
+#define UNIT_N_INTERNED 5  // number of units in the static unit table (semibreve to semiquaver)
+#define UNIT_HANDLE_INVALID 0xFF
 typedef std::shared_ptr<const class Unit> UnitRef;
 
 
+// Trivially copyable handle to one of the units returned by Unit::get (an index into the static unit 
+// table), which can be copied and shared across threads without the reference counting of a UnitRef. 
+// Converts implicitly from a UnitRef.
+class UnitHandle
+{
+public:
+  UnitHandle() : mIx(UNIT_HANDLE_INVALID) {}
+  UnitHandle(const UnitRef& unit);
+
+  inline bool isValid() const { return mIx != UNIT_HANDLE_INVALID; }
+  inline int getIndex() const { return mIx; }
+  inline const class Unit& operator*() const;
+  inline const class Unit* operator->() const;
+  // returns the shared unit (for the interfaces that still take a UnitRef)
+  UnitRef getRef() const;
+
+  friend inline bool operator==(UnitHandle lhs, UnitHandle rhs) { return lhs.mIx == rhs.mIx; }
+  friend inline bool operator!=(UnitHandle lhs, UnitHandle rhs) { return lhs.mIx != rhs.mIx; }
+
+private:
+  uint8_t mIx;
+};
+
+
 class Unit
 {
 public:
@@ -17,14 +44,16 @@ public:
 
   static UnitRef get(int numerator, int denominator);
   static UnitRef get(int denominator);
+  // returns the unit at the given index of the static unit table (see UnitHandle)
+  static const Unit& getInterned(int ix);
 
   virtual ~Unit() {};
 
   inline int getNumerator() const { return mNumerator; }
   inline int getDenominator() const { return mDenominator; }
 
-  double convert(double value, UnitRef toUnit) const;
-  int convertExact(int value, UnitRef toUnit) const;
+  double convert(double value, UnitHandle toUnit) const;
+  int convertExact(int value, UnitHandle toUnit) const;
 
   bool operator==(const Unit& other) const;
   bool operator<(const Unit& other) const;
@@ -41,3 +70,13 @@ private:
   const int mDenominator;
   const int mInAtoms;
 };
+
+inline const Unit& UnitHandle::operator*() const
+{
+  return Unit::getInterned(mIx);
+}
+
+inline const Unit* UnitHandle::operator->() const
+{
+  return &Unit::getInterned(mIx);
+}
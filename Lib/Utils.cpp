@@ -0,0 +1,61 @@
+#include "Utils.h"
+#include <stdlib.h>
+#include <stdio.h>
+
+#ifdef _MSC_VER
+#include <malloc.h>
+#endif
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#endif
+
+void* alignedMalloc(size_t size, size_t alignment)
+{
+#ifdef _MSC_VER
+  return _aligned_malloc(size, alignment);
+#else
+  void* ptr = nullptr;
+  if (posix_memalign(&ptr, alignment, size) != 0)
+    return nullptr;
+  return ptr;
+#endif
+}
+
+void alignedFree(void* ptr)
+{
+#ifdef _MSC_VER
+  _aligned_free(ptr);
+#else
+  free(ptr);
+#endif
+}
+
+bool replaceFile(const char* from, const char* to)
+{
+#ifdef _WIN32
+  // rename() doesn't replace existing files on windows
+  return MoveFileExA(from, to, MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH) != 0;
+#else
+  return rename(from, to) == 0;
+#endif
+}
+
+std::string getTempDirectory()
+{
+#ifdef _WIN32
+  char dir[MAX_PATH + 1];
+  const DWORD length = GetTempPathA(sizeof(dir), dir);
+  if (length > 0 && length <= MAX_PATH)
+    return std::string(dir, length);  // already ends with a backslash
+  return ".\\";
+#else
+  const char* dir = getenv("TMPDIR");
+  std::string path = dir && *dir ? dir : "/tmp";
+  if (path.back() != '/')
+    path += '/';
+  return path;
+#endif
+}
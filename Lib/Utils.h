@@ -1 +1,41 @@
 #pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+// allocates a block of the given size (in bytes) whose address is a multiple of the given 
+// alignment, which must be a power of two. Returns nullptr if the allocation failed.
+void* alignedMalloc(size_t size, size_t alignment);
+
+// releases a block previously allocated with alignedMalloc (nullptr is ignored)
+void alignedFree(void* ptr);
+
+// renames the file at from to to, replacing to if it exists (the replacement is atomic on POSIX and NTFS). 
+// Returns false if the file couldn't be renamed, in which case to is left as it was.
+bool replaceFile(const char* from, const char* to);
+
+// returns the directory for temporary files of the user, ending with a path separator
+std::string getTempDirectory();
+
+// returns the number of trailing zero bits of the given value, which must not be 0
+inline int countTrailingZeros(uint64_t value)
+{
+#if defined(_MSC_VER) && defined(_M_X64)
+  unsigned long ix;
+  _BitScanForward64(&ix, value);
+  return (int)ix;
+#elif defined(_MSC_VER)
+  unsigned long ix;
+  if (_BitScanForward(&ix, (unsigned long)value))
+    return (int)ix;
+  _BitScanForward(&ix, (unsigned long)(value >> 32));
+  return (int)ix + 32;
+#else
+  return __builtin_ctzll(value);
+#endif
+}
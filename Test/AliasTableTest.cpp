@@ -0,0 +1,26 @@
+#include "gtest/gtest.h"
+#include "AliasTable.h"
+
+TEST(AliasTableTests, DrawsProportionallyToWeights)
+{
+  const std::vector<double> weights = { 1.0, 0.0, 3.0, 0.5, 5.5 };
+  AliasTable table(weights);
+  ASSERT_EQ(weights.size(), table.size());
+  ASSERT_DOUBLE_EQ(0.3, table.getProbability(2));
+
+  std::mt19937 random(37);
+  std::vector<int> counts(weights.size(), 0);
+  const int nDraws = 100000;
+  for (int i = 0; i < nDraws; ++i)
+    ++counts[table.draw(random)];
+
+  ASSERT_EQ(0, counts[1]);
+  for (size_t i = 0; i < weights.size(); ++i)
+    ASSERT_NEAR(table.getProbability(i), (double)counts[i] / nDraws, 0.01);
+}
+
+TEST(AliasTableTests, RejectsEmptyWeights)
+{
+  ASSERT_THROW(AliasTable(std::vector<double>()), std::runtime_error);
+  ASSERT_THROW(AliasTable(std::vector<double>(3, 0.0)), std::runtime_error);
+}
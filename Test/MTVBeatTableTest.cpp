@@ -0,0 +1,53 @@
+#include "gtest/gtest.h"
+#include "gmock/gmock.h"
+#include "MTVRhythmSpace.h"
+#include <algorithm>
+
+static void expectBeatTableMatchesComputeMTV(const TimeSignature& ts, UnitRef stepUnit)
+{
+  MetricalSalienceRange prfRange;
+  prfRange.second = 0;
+  const MetricalSalienceProfile prf = ts.getMetricalSalienceProfile(stepUnit, prfRange.second);
+  prfRange.first = *std::min_element(prf.begin(), prf.end());
+
+  MTVBeatTable table(ts, stepUnit, prf, prfRange);
+  ASSERT_TRUE(table.isValid());
+
+  RhythmPattern rp(ts, stepUnit);
+  const int N = rp.getNSteps();
+  const PatternId nPatterns = 1ULL << N;
+  std::vector<Tension> expectedMtv(N), actualMtv(N);
+
+  for (PatternId patternId = 0; patternId < nPatterns; ++patternId) {
+    rp.setPatternId(patternId);
+    computeMTV(rp, prf, prfRange, expectedMtv.data());
+    computeMTV(patternId, table, actualMtv.data());
+    ASSERT_EQ(expectedMtv, actualMtv) << "pattern " << patternId;
+  }
+}
+
+TEST(MTVBeatTableTests, FourFourthSemiquavers)
+{
+  expectBeatTableMatchesComputeMTV(TimeSignature(4, 4), Unit::SEMIQUAVER);
+}
+
+TEST(MTVBeatTableTests, ThreeFourthSemiquavers)
+{
+  expectBeatTableMatchesComputeMTV(TimeSignature(3, 4), Unit::SEMIQUAVER);
+}
+
+TEST(MTVBeatTableTests, SixEighthSemiquavers)
+{
+  expectBeatTableMatchesComputeMTV(TimeSignature(6, 8), Unit::SEMIQUAVER);
+}
+
+TEST(MTVBeatTableTests, TwoHalfSemiquavers)
+{
+  expectBeatTableMatchesComputeMTV(TimeSignature(2, 2), Unit::SEMIQUAVER);
+}
+
+TEST(MTVBeatTableTests, OneStepPerBeat)
+{
+  expectBeatTableMatchesComputeMTV(TimeSignature(4, 4), Unit::CROTCHET);
+  expectBeatTableMatchesComputeMTV(TimeSignature(6, 8), Unit::QUAVER);
+}
@@ -0,0 +1,104 @@
+#include "gtest/gtest.h"
+#include "MTVBlockKernel.h"
+#include "MTVRhythmSpace.h"
+#include <algorithm>
+#include <random>
+#include <vector>
+
+// compares the block kernel at every supported instruction set with the scalar computeMTV, for the given patterns
+static void expectBlockKernelMatchesComputeMTV(const TimeSignature& ts, UnitRef stepUnit, const std::vector<PatternId>& patternIds)
+{
+  MetricalSalienceRange prfRange;
+  prfRange.second = 0;
+  const MetricalSalienceProfile prf = ts.getMetricalSalienceProfile(stepUnit, prfRange.second);
+  prfRange.first = *std::min_element(prf.begin(), prf.end());
+
+  MTVBeatTable table(ts, stepUnit, prf, prfRange);
+  ASSERT_TRUE(table.isValid());
+
+  RhythmPattern rp(ts, stepUnit);
+  const int N = rp.getNSteps();
+  std::vector<Tension> expectedMtvs(patternIds.size() * N);
+  for (size_t i = 0; i < patternIds.size(); ++i) {
+    rp.setPatternId(patternIds[i]);
+    computeMTV(rp, prf, prfRange, &expectedMtvs[i * N]);
+  }
+
+  for (int level = SimdLevel::SCALAR; level <= getSupportedSimdLevel(); ++level) {
+    MTVBlockKernel kernel(table, (SimdLevel)level);
+    std::vector<Tension> actualMtvs(patternIds.size() * N);
+    kernel.computeMTVs(patternIds.data(), patternIds.size(), actualMtvs.data());
+
+    for (size_t i = 0; i < patternIds.size(); ++i) {
+      ASSERT_TRUE(std::equal(&expectedMtvs[i * N], &expectedMtvs[i * N] + N, &actualMtvs[i * N]))
+        << ts.getNumerator() << "/" << ts.getDenominator() << ", level " << level << ", pattern " << patternIds[i];
+    }
+  }
+}
+
+static std::vector<PatternId> getAllPatterns(int nSteps)
+{
+  std::vector<PatternId> patternIds((size_t)1 << nSteps);
+  for (size_t i = 0; i < patternIds.size(); ++i)
+    patternIds[i] = (PatternId)i;
+  return patternIds;
+}
+
+static std::vector<PatternId> getRandomPatterns(int nSteps, size_t count)
+{
+  std::mt19937_64 random(11);
+  std::vector<PatternId> patternIds(count);
+  for (PatternId& patternId : patternIds)
+    patternId = nSteps < MAX_N_STEPS ? random() & (((PatternId)1 << nSteps) - 1) : random();
+  return patternIds;
+}
+
+TEST(MTVBlockKernelTests, AllPatternsMatchComputeMTV)
+{
+  expectBlockKernelMatchesComputeMTV(TimeSignature(4, 4), Unit::SEMIQUAVER, getAllPatterns(16));
+  expectBlockKernelMatchesComputeMTV(TimeSignature(3, 4), Unit::SEMIQUAVER, getAllPatterns(12));
+  expectBlockKernelMatchesComputeMTV(TimeSignature(6, 8), Unit::SEMIQUAVER, getAllPatterns(12));
+  expectBlockKernelMatchesComputeMTV(TimeSignature(4, 4), Unit::QUAVER, getAllPatterns(8));
+  expectBlockKernelMatchesComputeMTV(TimeSignature(2, 2), Unit::SEMIQUAVER, getAllPatterns(16));
+  expectBlockKernelMatchesComputeMTV(TimeSignature(6, 8), Unit::QUAVER, getAllPatterns(6));
+}
+
+TEST(MTVBlockKernelTests, LongMeasuresMatchComputeMTV)
+{
+  // beats straddling and above the low 32 bits of the pattern ids
+  expectBlockKernelMatchesComputeMTV(TimeSignature(9, 4), Unit::SEMIQUAVER, getRandomPatterns(36, 4099));
+  expectBlockKernelMatchesComputeMTV(TimeSignature(12, 4), Unit::SEMIQUAVER, getRandomPatterns(48, 4099));
+  expectBlockKernelMatchesComputeMTV(TimeSignature(16, 4), Unit::SEMIQUAVER, getRandomPatterns(64, 4099));
+}
+
+TEST(MTVBlockKernelTests, RangeMatchesPatternList)
+{
+  const TimeSignature ts(3, 4);
+  MeterTablesRef tables = MeterTables::get(ts, Unit::SEMIQUAVER);
+  MetricalSalienceRange prfRange(0, 0);
+  const MetricalSalienceProfile prf = tables->getMetricalSalienceProfile(prfRange.second);
+  prfRange.first = *std::min_element(prf.begin(), prf.end());
+
+  MTVBeatTable table(ts, Unit::SEMIQUAVER, prf, prfRange);
+  MTVBlockKernel kernel(table);
+  const PatternId begin = 1001;
+  const size_t count = 203;  // not a multiple of the lanes
+  std::vector<PatternId> patternIds(count);
+  for (size_t i = 0; i < count; ++i)
+    patternIds[i] = begin + i;
+
+  std::vector<Tension> rangeMtvs(count * 12), listMtvs(count * 12);
+  kernel.computeMTVRange(begin, count, rangeMtvs.data());
+  kernel.computeMTVs(patternIds.data(), count, listMtvs.data());
+  ASSERT_EQ(listMtvs, rangeMtvs);
+}
+
+TEST(MTVBlockKernelTests, RequiresValidBeatTable)
+{
+  // beats longer than MTV_BEAT_TABLE_MAX_STEPS_PER_BEAT
+  const TimeSignature ts(1, 1);
+  const MetricalSalienceProfile prf = ts.getMetricalSalienceProfile(Unit::SEMIQUAVER, 0);
+  MTVBeatTable table(ts, Unit::SEMIQUAVER, prf, MetricalSalienceRange(*std::min_element(prf.begin(), prf.end()), 0));
+  ASSERT_FALSE(table.isValid());
+  ASSERT_THROW(MTVBlockKernel kernel(table), std::runtime_error);
+}
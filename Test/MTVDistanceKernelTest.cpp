@@ -0,0 +1,80 @@
+#include "gtest/gtest.h"
+#include "MTVDistanceKernel.h"
+#include <algorithm>
+#include <random>
+#include <vector>
+
+static double referenceSquaredDistance(const Tension * a, const Tension * b, int nDims)
+{
+  double totalSquaredDiff = 0.0;
+  for (int pos = 0; pos < nDims; ++pos)
+    totalSquaredDiff += (a[pos] - b[pos]) * (a[pos] - b[pos]);
+  return totalSquaredDiff;
+}
+
+static float unitsSquaredDistance(const Tension * a, const Tension * b, int nDims)
+{
+  int32_t units = 0;
+  for (int pos = nDims - 1; pos >= 0; --pos)  // any order gives the same sum
+    units += getSquaredDiffUnits(a[pos], b[pos]);
+  return unitsToSquaredDistance(units);
+}
+
+TEST(MTVDistanceKernelTests, AllLevelsMatchReference)
+{
+  std::mt19937 random(7);
+  std::uniform_real_distribution<float> tensionDist(0.0f, 1.0f);
+  const size_t count = 37;  // not a multiple of any vector width
+
+  for (int level = SimdLevel::SCALAR; level <= getSupportedSimdLevel(); ++level) {
+    for (int nDims = 1; nDims <= 20; ++nDims) {
+      std::vector<Tension> target(nDims), rows(count * nDims), columns(nDims * count);
+      for (Tension& t : target) t = tensionDist(random);
+      for (size_t i = 0; i < count; ++i) {
+        for (int pos = 0; pos < nDims; ++pos)
+          rows[i * nDims + pos] = columns[pos * count + i] = tensionDist(random);
+      }
+
+      std::vector<float> rowMajorOut(count), columnMajorOut(count);
+      computeSquaredDistances(target.data(), rows.data(), count, nDims, rowMajorOut.data(), (SimdLevel)level);
+      computeSquaredDistancesColumnMajor(target.data(), columns.data(), count, 0, count, nDims, 
+        columnMajorOut.data(), (SimdLevel)level);
+
+      for (size_t i = 0; i < count; ++i) {
+        const double expected = referenceSquaredDistance(target.data(), &rows[i * nDims], nDims);
+        ASSERT_NEAR(expected, rowMajorOut[i], nDims / MTV_DISTANCE_UNITS) << "level " << level << ", dims " << nDims;
+
+        // bit-identical to the units sum, whatever the instruction set and layout
+        const float exact = unitsSquaredDistance(target.data(), &rows[i * nDims], nDims);
+        ASSERT_EQ(exact, rowMajorOut[i]) << "level " << level << ", dims " << nDims;
+        ASSERT_EQ(exact, columnMajorOut[i]) << "level " << level << ", dims " << nDims;
+      }
+    }
+  }
+}
+
+TEST(MTVDistanceKernelTests, EqualDifferencesGiveEqualDistances)
+{
+  // the same differences at other steps give the same distance, which float sums in another order don't
+  // guarantee (as for patterns with permuted steps at the same distance from a flat target)
+  std::mt19937 random(11);
+  std::uniform_real_distribution<float> tensionDist(0.0f, 1.0f);
+  const int nDims = 16;
+  const size_t count = 64;
+  const std::vector<Tension> target(nDims, 0.3f);
+  std::vector<Tension> rows(count * nDims);
+
+  for (int pos = 0; pos < nDims; ++pos)
+    rows[pos] = tensionDist(random);
+  for (size_t i = 1; i < count; ++i) {
+    std::copy(rows.begin(), rows.begin() + nDims, rows.begin() + i * nDims);
+    std::shuffle(rows.begin() + i * nDims, rows.begin() + (i + 1) * nDims, random);
+  }
+
+  for (int level = SimdLevel::SCALAR; level <= getSupportedSimdLevel(); ++level) {
+    std::vector<float> out(count);
+    computeSquaredDistances(target.data(), rows.data(), count, nDims, out.data(), (SimdLevel)level);
+    for (size_t i = 1; i < count; ++i)
+      ASSERT_EQ(out[0], out[i]) << "level " << level << ", point " << i;
+  }
+}
@@ -1,6 +1,10 @@
 #include "gtest/gtest.h"
 #include "gmock/gmock.h"
 #include "MTVRhythmSpace.h"
+#include "Utils.h"
+#include <thread>
+#include <cstdio>
+#include <map>
 
 // TODO DRY
 template <int N>
@@ -91,3 +95,682 @@ TEST(MTVRhythmSpaceTests, FillAndGetMTV)
   ASSERT_THAT(eMtv10, ::testing::ElementsAreArray(aMtv10));
   ASSERT_THAT(eMtv11, ::testing::ElementsAreArray(aMtv11));
 }
+
+TEST(MTVRhythmSpaceTests, ColumnMajorMatchesRowMajor)
+{
+  MTVRhythmSpace rowMajor(TimeSignature(3, 4), Unit::QUAVER, MTVRhythmSpace::PointLayout::ROW_MAJOR);
+  MTVRhythmSpace colMajor(TimeSignature(3, 4), Unit::QUAVER, MTVRhythmSpace::PointLayout::COLUMN_MAJOR);
+  rowMajor.fill();
+  colMajor.fill();
+
+  const int N = rowMajor.getDimensions();
+  std::vector<Tension> mtv(N);
+
+  for (PatternId patternId = 0; patternId < (PatternId)rowMajor.getPatternCount(); ++patternId) {
+    ASSERT_TRUE(colMajor.getMTV(patternId, mtv.data()));
+    ASSERT_THAT(mtv, ::testing::ElementsAreArray(rowMajor.getMTV(patternId), N));
+  }
+
+  const Tension target[6] = { 0.1f, 0.9f, 0.3f, 0.7f, 0.5f, 0.5f };
+  ASSERT_EQ(rowMajor.getClosestPattern(target), colMajor.getClosestPattern(target));
+}
+
+TEST(MTVRhythmSpaceTests, GetMTVOutOfRange)
+{
+  MTVRhythmSpace s(TimeSignature(2, 4), Unit::CROTCHET);
+  s.fill();
+  Tension mtv[2];
+  ASSERT_EQ(nullptr, s.getMTV(4));
+  ASSERT_FALSE(s.getMTV(4, mtv));
+}
+
+TEST(MTVRhythmSpaceTests, ParallelFillMatchesSerialFill)
+{
+  MTVRhythmSpace serial(TimeSignature(4, 4), Unit::SEMIQUAVER);
+  MTVRhythmSpace parallel(TimeSignature(4, 4), Unit::SEMIQUAVER);
+  serial.fill(nullptr, 1);
+
+  std::vector<double> progress;
+  parallel.fill([&progress](double p) { progress.push_back(p); }, 4);
+
+  const int N = serial.getDimensions();
+  for (PatternId patternId = 0; patternId < (PatternId)serial.getPatternCount(); ++patternId)
+    ASSERT_THAT(std::vector<Tension>(parallel.getMTV(patternId), parallel.getMTV(patternId) + N),
+      ::testing::ElementsAreArray(serial.getMTV(patternId), N));
+
+  ASSERT_FALSE(progress.empty());
+  ASSERT_LE(progress.size(), (size_t)MTV_RHYTHM_SPACE_FILL_PROGRESS_STEPS + 1);
+  ASSERT_TRUE(std::is_sorted(progress.begin(), progress.end()));
+  ASSERT_DOUBLE_EQ(1.0, progress.back());
+}
+
+TEST(MTVRhythmSpaceTests, ImplicitClosestPatternMatchesMaterialized)
+{
+  MTVRhythmSpace materialized(TimeSignature(4, 4), Unit::SEMIQUAVER);
+  MTVRhythmSpace implicit(TimeSignature(4, 4), Unit::SEMIQUAVER, 
+    MTVRhythmSpace::PointLayout::ROW_MAJOR, MTVRhythmSpace::QueryBackend::IMPLICIT);
+  materialized.fill();
+  implicit.fill();
+
+  std::mt19937 random(42);
+  std::uniform_real_distribution<float> tensionDist(0.0f, 1.0f);
+  std::vector<Tension> target(16), closestMtv(16);
+
+  for (int i = 0; i < 50; ++i) {
+    for (Tension& t : target) t = tensionDist(random);
+    const PatternId expected = materialized.getClosestPattern(target.data());
+    const PatternId actual = implicit.getClosestPattern(target.data());
+    ASSERT_TRUE(implicit.getMTV(actual, closestMtv.data()));
+    ASSERT_FLOAT_EQ(
+      materialized.getDistance(target.data(), materialized.getMTV(expected)),
+      materialized.getDistance(target.data(), closestMtv.data()));
+  }
+}
+
+TEST(MTVRhythmSpaceTests, ImplicitClosestPatternTies)
+{
+  MTVRhythmSpace materialized(TimeSignature(4, 4), Unit::SEMIQUAVER);
+  MTVRhythmSpace implicit(TimeSignature(4, 4), Unit::SEMIQUAVER,
+    MTVRhythmSpace::PointLayout::ROW_MAJOR, MTVRhythmSpace::QueryBackend::IMPLICIT);
+  materialized.fill();
+  implicit.fill();
+
+  // targets halfway between two patterns are at the same distance of both
+  std::mt19937 random(7);
+  std::uniform_int_distribution<PatternId> patternDist(0, 0xffff);
+  std::vector<Tension> target(16);
+  int nTies = 0;
+
+  for (int i = 0; i < 100; ++i) {
+    const Tension * const mtvA = materialized.getMTV(patternDist(random));
+    const Tension * const mtvB = materialized.getMTV(patternDist(random));
+    for (int pos = 0; pos < 16; ++pos)
+      target[pos] = (mtvA[pos] + mtvB[pos]) / 2;
+
+    const std::vector<MTVRhythmSpace::Neighbour> nearest = materialized.getKNearest(target.data(), 2);
+    if (nearest[0].distance == nearest[1].distance)
+      ++nTies;
+
+    ASSERT_EQ(nearest[0].patternId, implicit.getClosestPattern(target.data()));
+  }
+
+  ASSERT_GT(nTies, 0);
+}
+
+TEST(MTVRhythmSpaceTests, ImplicitThirtyTwoSteps)
+{
+  MTVRhythmSpace s(TimeSignature(8, 4), Unit::SEMIQUAVER, 
+    MTVRhythmSpace::PointLayout::ROW_MAJOR, MTVRhythmSpace::QueryBackend::IMPLICIT);
+  s.fill();
+  ASSERT_EQ(32, s.getDimensions());
+
+  // the closest pattern to a pattern's own mtv is at distance zero
+  const PatternId patternId = createPattern<32>("x--x---x--x-x---x-x-x--x-x--x--x");
+  std::vector<Tension> mtv(32), closestMtv(32);
+  ASSERT_TRUE(s.getMTV(patternId, mtv.data()));
+  ASSERT_TRUE(s.getMTV(s.getClosestPattern(mtv.data()), closestMtv.data()));
+  ASSERT_EQ(mtv, closestMtv);
+}
+
+TEST(MTVRhythmSpaceTests, PartialSortMatchesFullSort)
+{
+  MTVRhythmSpace fullSort(TimeSignature(3, 4), Unit::SEMIQUAVER);
+  MTVRhythmSpace partialSort(TimeSignature(3, 4), Unit::SEMIQUAVER);
+  fullSort.setDistanceCacheMode(MTVRhythmSpace::DistanceCacheMode::FULL_SORT);
+  partialSort.setDistanceCacheMode(MTVRhythmSpace::DistanceCacheMode::PARTIAL_SORT, 4);
+  fullSort.fill();
+  partialSort.fill();
+
+  const Tension target[12] = { 0.0f, 0.8f, 0.6f, 0.9f, 0.1f, 0.5f, 0.7f, 1.0f, 0.2f, 0.4f, 0.3f, 0.6f };
+  ASSERT_EQ(fullSort.getClosestPattern(target), partialSort.getClosestPattern(target));
+
+  // both spaces use equally seeded random generators, so they should pick the same patterns
+  for (int i = 0; i < 200; ++i)
+    ASSERT_EQ(fullSort.getRandomPatternCloseTo(target, 0.3f), partialSort.getRandomPatternCloseTo(target, 0.3f));
+}
+
+TEST(MTVRhythmSpaceTests, ConcurrentQueryContexts)
+{
+  MTVRhythmSpace s(TimeSignature(4, 4), Unit::SEMIQUAVER);
+  s.fill();
+  const MTVRhythmSpace& space = s;
+
+  const int nThreads = 4;
+  std::vector<std::vector<Tension>> targets(nThreads, std::vector<Tension>(16));
+  std::mt19937 random(3);
+  std::uniform_real_distribution<float> tensionDist(0.0f, 1.0f);
+  for (auto& target : targets)
+    for (Tension& t : target) t = tensionDist(random);
+
+  // expected results, computed one context at a time
+  std::vector<PatternId> expected(nThreads * 2);
+  for (int i = 0; i < nThreads; ++i) {
+    MTVRhythmSpace::QueryContext ctx(MTVRhythmSpace::DistanceCacheMode::PARTIAL_SORT, i);
+    expected[i * 2] = space.getClosestPattern(targets[i].data(), ctx);
+    expected[i * 2 + 1] = space.getRandomPatternCloseTo(targets[i].data(), ctx);
+  }
+
+  std::vector<PatternId> actual(nThreads * 2);
+  std::vector<std::thread> threads;
+  for (int i = 0; i < nThreads; ++i) {
+    threads.emplace_back([&, i]() {
+      MTVRhythmSpace::QueryContext ctx(MTVRhythmSpace::DistanceCacheMode::PARTIAL_SORT, i);
+      actual[i * 2] = space.getClosestPattern(targets[i].data(), ctx);
+      actual[i * 2 + 1] = space.getRandomPatternCloseTo(targets[i].data(), ctx);
+    });
+  }
+
+  for (auto& thread : threads)
+    thread.join();
+
+  ASSERT_EQ(expected, actual);
+}
+
+TEST(MTVRhythmSpaceTests, SingleStepChangeMatchesFullScan)
+{
+  MTVRhythmSpace s(TimeSignature(4, 4), Unit::SEMIQUAVER);
+  s.fill();
+
+  std::mt19937 random(11);
+  std::uniform_real_distribution<float> tensionDist(0.0f, 1.0f);
+  std::uniform_int_distribution<int> stepDist(0, 15);
+  std::vector<Tension> target(16);
+  for (Tension& t : target) t = tensionDist(random);
+
+  for (auto mode : { MTVRhythmSpace::DistanceCacheMode::FULL_SORT, MTVRhythmSpace::DistanceCacheMode::PARTIAL_SORT }) {
+    MTVRhythmSpace::QueryContext dragCtx(mode);
+    s.getClosestPattern(target.data(), dragCtx);
+
+    // move one node at a time, like when dragging on the tension canvas
+    for (int i = 0; i < 40; ++i) {
+      target[stepDist(random)] = tensionDist(random);
+      MTVRhythmSpace::QueryContext freshCtx(mode);
+      const PatternId expected = s.getClosestPattern(target.data(), freshCtx);
+      const PatternId actual = s.getClosestPattern(target.data(), dragCtx);
+      ASSERT_NEAR(
+        s.getDistance(target.data(), s.getMTV(expected)), 
+        s.getDistance(target.data(), s.getMTV(actual)), 1e-6);
+    }
+  }
+}
+
+TEST(MTVRhythmSpaceTests, SingleStepChangeWithDefaultContext)
+{
+  MTVRhythmSpace s(TimeSignature(4, 4), Unit::SEMIQUAVER);
+  s.fill();
+
+  std::mt19937 random(13);
+  std::uniform_real_distribution<float> tensionDist(0.0f, 1.0f);
+  std::uniform_int_distribution<int> stepDist(0, 15);
+  std::vector<Tension> target(16);
+  for (Tension& t : target) t = tensionDist(random);
+
+  // the default (PARTIAL_SORT) context takes the single-step path as well
+  MTVRhythmSpace::QueryContext dragCtx;
+  s.getRandomPatternCloseTo(target.data(), dragCtx, 0.1f);
+  ASSERT_EQ(0, dragCtx.getIncrementalUpdateCount());
+
+  // there's no periodic re-scan, updates go on as long as a single step changes
+  for (int i = 1; i <= 50; ++i) {
+    const int step = stepDist(random);
+    target[step] = target[step] < 0.5f ? target[step] + 0.25f : target[step] - 0.25f;
+    s.getRandomPatternCloseTo(target.data(), dragCtx, 0.1f);
+    ASSERT_EQ(i, dragCtx.getIncrementalUpdateCount());
+
+    // the updated cache orders the patterns like a fresh scan
+    MTVRhythmSpace::QueryContext freshCtx;
+    ASSERT_EQ(s.getClosestPattern(target.data(), freshCtx), s.getClosestPattern(target.data(), dragCtx));
+  }
+}
+
+TEST(MTVRhythmSpaceTests, QuantizedMatchesFloat)
+{
+  MTVRhythmSpace floatSpace(TimeSignature(3, 4), Unit::SEMIQUAVER);
+  MTVRhythmSpace quantizedSpace(TimeSignature(3, 4), Unit::SEMIQUAVER, MTVRhythmSpace::PointLayout::ROW_MAJOR,
+    MTVRhythmSpace::QueryBackend::MATERIALIZED, MTVRhythmSpace::PointFormat::QUANTIZED_UINT8);
+  floatSpace.fill();
+  quantizedSpace.fill();
+
+  const int N = floatSpace.getDimensions();
+  std::vector<Tension> mtv(N);
+
+  for (PatternId patternId = 0; patternId < floatSpace.getPatternCount(); ++patternId) {
+    ASSERT_TRUE(quantizedSpace.getMTV(patternId, mtv.data()));
+    ASSERT_THAT(mtv, ::testing::ElementsAreArray(floatSpace.getMTV(patternId), N));
+  }
+
+  ASSERT_THROW(quantizedSpace.getMTV(0), std::runtime_error);
+
+  // targets off the level grid
+  std::mt19937 random(5);
+  std::uniform_real_distribution<float> tensionDist(0.0f, 1.0f);
+  for (int i = 0; i < 20; ++i) {
+    for (Tension& t : mtv) t = tensionDist(random);
+    const PatternId expected = floatSpace.getClosestPattern(mtv.data());
+    const PatternId actual = quantizedSpace.getClosestPattern(mtv.data());
+    ASSERT_NEAR(
+      floatSpace.getDistance(mtv.data(), floatSpace.getMTV(expected)),
+      floatSpace.getDistance(mtv.data(), floatSpace.getMTV(actual)), 1e-6);
+  }
+
+  // targets on the level grid are matched exactly, ties resolved by lowest pattern id
+  const PatternId patternId = createPattern<12>("x--x-x--x-x-");
+  std::vector<Tension> onGrid(floatSpace.getMTV(patternId), floatSpace.getMTV(patternId) + N);
+  const PatternId closest = quantizedSpace.getClosestPattern(onGrid.data());
+  ASSERT_EQ(floatSpace.getClosestPattern(onGrid.data()), closest);
+  ASSERT_EQ(0.0, floatSpace.getDistance(onGrid.data(), floatSpace.getMTV(closest)));
+
+  for (int i = 0; i < 50; ++i) {
+    const PatternId randomPattern = quantizedSpace.getRandomPatternCloseTo(onGrid.data(), 0.2f);
+    ASSERT_LT(randomPattern, quantizedSpace.getPatternCount());
+  }
+}
+
+// removes a file when it goes out of scope, also when an assertion fails
+struct ScopedFileRemover
+{
+  std::string path;
+  ~ScopedFileRemover() { std::remove(path.c_str()); }
+};
+
+static bool fileExists(const std::string& path)
+{
+  std::FILE* file = std::fopen(path.c_str(), "rb");
+  if (file) std::fclose(file);
+  return file != nullptr;
+}
+
+TEST(MTVRhythmSpaceTests, SaveAndOpen)
+{
+  for (auto format : { MTVRhythmSpace::PointFormat::FLOAT32, MTVRhythmSpace::PointFormat::QUANTIZED_UINT8 }) {
+    // declared before the spaces, so the file is removed after they are destroyed (and have unmapped it)
+    ScopedFileRemover savedFile;
+    MTVRhythmSpace filled(TimeSignature(3, 4), Unit::SEMIQUAVER, MTVRhythmSpace::PointLayout::COLUMN_MAJOR,
+      MTVRhythmSpace::QueryBackend::MATERIALIZED, format);
+    MTVRhythmSpace opened(TimeSignature(3, 4), Unit::SEMIQUAVER, MTVRhythmSpace::PointLayout::COLUMN_MAJOR,
+      MTVRhythmSpace::QueryBackend::MATERIALIZED, format);
+    const std::string path = getTempDirectory() + filled.getFileName();
+    savedFile.path = path;
+
+    ASSERT_FALSE(opened.open("does-not-exist.mtvs"));
+    ASSERT_FALSE(opened.ready());
+
+    filled.fill();
+    filled.save(path);
+    ASSERT_FALSE(fileExists(path + ".tmp"));  // renamed over the target
+    ASSERT_TRUE(opened.open(path));
+    ASSERT_TRUE(opened.ready());
+
+    const int N = filled.getDimensions();
+    std::vector<Tension> expected(N), actual(N);
+
+    for (PatternId patternId = 0; patternId < filled.getPatternCount(); ++patternId) {
+      ASSERT_TRUE(filled.getMTV(patternId, expected.data()));
+      ASSERT_TRUE(opened.getMTV(patternId, actual.data()));
+      ASSERT_EQ(expected, actual);
+    }
+
+    const Tension target[12] = { 0.0f, 0.8f, 0.6f, 0.9f, 0.1f, 0.5f, 0.7f, 1.0f, 0.2f, 0.4f, 0.3f, 0.6f };
+    ASSERT_EQ(filled.getClosestPattern(target), opened.getClosestPattern(target));
+
+    // a file written for another space is rejected
+    MTVRhythmSpace otherLayout(TimeSignature(3, 4), Unit::SEMIQUAVER, MTVRhythmSpace::PointLayout::ROW_MAJOR,
+      MTVRhythmSpace::QueryBackend::MATERIALIZED, format);
+    MTVRhythmSpace otherMeter(TimeSignature(6, 8), Unit::SEMIQUAVER, MTVRhythmSpace::PointLayout::COLUMN_MAJOR,
+      MTVRhythmSpace::QueryBackend::MATERIALIZED, format);
+    ASSERT_FALSE(otherLayout.open(path));
+    ASSERT_FALSE(otherMeter.open(path));
+    ASSERT_NE(filled.getFileName(), otherMeter.getFileName());
+  }
+}
+
+TEST(MTVRhythmSpaceTests, CancelledFill)
+{
+  MTVRhythmSpace reference(TimeSignature(4, 4), Unit::SEMIQUAVER);
+  reference.fill();
+
+  for (int nThreads : { 1, 4 }) {
+    MTVRhythmSpace s(TimeSignature(4, 4), Unit::SEMIQUAVER);
+
+    CancellationToken cancelledBefore;
+    cancelledBefore.cancel();
+    ASSERT_FALSE(s.fill(nullptr, nThreads, &cancelledBefore));
+    ASSERT_FALSE(s.ready());
+
+    // cancel as soon as some progress is reported (only deterministic on the calling thread, 
+    // parallel workers might be done with all chunks before the first report)
+    if (nThreads == 1) {
+      CancellationToken cancelledDuring;
+      double lastProgress = 0.0;
+      auto cancelOnProgress = [&](double progress) {
+        lastProgress = progress;
+        cancelledDuring.cancel();
+      };
+
+      ASSERT_FALSE(s.fill(cancelOnProgress, nThreads, &cancelledDuring));
+      ASSERT_FALSE(s.ready());
+      ASSERT_LT(lastProgress, 1.0);
+    }
+
+    // a cancelled space can be filled again
+    CancellationToken notCancelled;
+    ASSERT_TRUE(s.fill(nullptr, nThreads, &notCancelled));
+    ASSERT_TRUE(s.ready());
+
+    for (PatternId patternId = 0; patternId < s.getPatternCount(); patternId += 97)
+      ASSERT_THAT(std::vector<Tension>(s.getMTV(patternId), s.getMTV(patternId) + 16),
+        ::testing::ElementsAreArray(reference.getMTV(patternId), 16));
+  }
+}
+
+TEST(MTVRhythmSpaceTests, BatchQueriesMatchSingleQueries)
+{
+  const int nTargets = 25;
+  std::mt19937 random(17);
+  std::uniform_real_distribution<float> tensionDist(0.0f, 1.0f);
+  std::vector<Tension> targets(nTargets * 12);
+  for (Tension& t : targets) t = tensionDist(random);
+
+  std::vector<std::unique_ptr<MTVRhythmSpace>> spaces;
+  spaces.emplace_back(new MTVRhythmSpace(TimeSignature(3, 4), Unit::SEMIQUAVER));
+  spaces.emplace_back(new MTVRhythmSpace(TimeSignature(3, 4), Unit::SEMIQUAVER, MTVRhythmSpace::PointLayout::COLUMN_MAJOR));
+  spaces.emplace_back(new MTVRhythmSpace(TimeSignature(3, 4), Unit::SEMIQUAVER, MTVRhythmSpace::PointLayout::ROW_MAJOR,
+    MTVRhythmSpace::QueryBackend::IMPLICIT));
+  spaces.emplace_back(new MTVRhythmSpace(TimeSignature(3, 4), Unit::SEMIQUAVER, MTVRhythmSpace::PointLayout::ROW_MAJOR,
+    MTVRhythmSpace::QueryBackend::MATERIALIZED, MTVRhythmSpace::PointFormat::QUANTIZED_UINT8));
+
+  for (auto& s : spaces) {
+    s->fill();
+    std::vector<PatternId> closest(nTargets);
+    s->getClosestPatterns(targets.data(), nTargets, closest.data());
+
+    for (int i = 0; i < nTargets; ++i) {
+      MTVRhythmSpace::QueryContext ctx;
+      ASSERT_EQ(s->getClosestPattern(&targets[i * 12], ctx), closest[i]);
+    }
+
+    if (s->getQueryBackend() == MTVRhythmSpace::QueryBackend::IMPLICIT)
+      continue;
+
+    // a context seeded like a batch target draws the same random distance, so both picks are in the same cluster
+    std::vector<std::mt19937::result_type> seeds(nTargets);
+    std::vector<float> distanceSDs(nTargets);
+    for (int i = 0; i < nTargets; ++i) {
+      seeds[i] = 1000 + i;
+      distanceSDs[i] = 0.05f * (i % 5);
+    }
+
+    std::vector<PatternId> picks(nTargets), repeatedPicks(nTargets);
+    MTVRhythmSpace::QueryContext batchCtx;
+    s->getRandomPatternsCloseTo(targets.data(), nTargets, picks.data(), batchCtx, 0.1f, distanceSDs.data(), seeds.data());
+    s->getRandomPatternsCloseTo(targets.data(), nTargets, repeatedPicks.data(), batchCtx, 0.1f, distanceSDs.data(), seeds.data());
+    ASSERT_EQ(picks, repeatedPicks);
+
+    std::vector<Tension> pickMtv(12), singlePickMtv(12);
+    for (int i = 0; i < nTargets; ++i) {
+      MTVRhythmSpace::QueryContext ctx(MTVRhythmSpace::DistanceCacheMode::PARTIAL_SORT, seeds[i]);
+      const PatternId singlePick = s->getRandomPatternCloseTo(&targets[i * 12], ctx, distanceSDs[i]);
+      ASSERT_TRUE(s->getMTV(picks[i], pickMtv.data()));
+      ASSERT_TRUE(s->getMTV(singlePick, singlePickMtv.data()));
+      ASSERT_FLOAT_EQ(
+        s->getDistance(&targets[i * 12], singlePickMtv.data()), 
+        s->getDistance(&targets[i * 12], pickMtv.data()));
+    }
+  }
+}
+
+TEST(MTVRhythmSpaceTests, KNearestAndWithinRadius)
+{
+  MTVRhythmSpace s(TimeSignature(4, 4), Unit::SEMIQUAVER);
+  s.fill();
+
+  std::mt19937 random(23);
+  std::uniform_real_distribution<float> tensionDist(0.0f, 1.0f);
+  std::vector<Tension> target(16);
+  for (Tension& t : target) t = tensionDist(random);
+
+  // reference: all patterns sorted by distance, then id
+  std::vector<std::pair<float, PatternId>> all;
+  for (PatternId patternId = 0; patternId < s.getPatternCount(); ++patternId)
+    all.push_back({ s.getDistance(target.data(), s.getMTV(patternId)), patternId });
+  std::sort(all.begin(), all.end());
+
+  const std::vector<MTVRhythmSpace::Neighbour> nearest = s.getKNearest(target.data(), 50);
+  ASSERT_EQ(50, nearest.size());
+  ASSERT_EQ(s.getClosestPattern(target.data()), nearest[0].patternId);
+
+  for (size_t i = 0; i < nearest.size(); ++i) {
+    ASSERT_NEAR(all[i].first, nearest[i].distance, 1e-6);
+    if (i > 0) {
+      ASSERT_LE(nearest[i - 1].distance, nearest[i].distance);
+    }
+  }
+
+  ASSERT_EQ(s.getPatternCount(), s.getKNearest(target.data(), 1 << 20).size());
+  ASSERT_TRUE(s.getKNearest(target.data(), 0).empty());
+
+  // the radius is taken between two distinct reference distances, so float rounding can't change the count
+  size_t nWithin = 200;
+  while (all[nWithin].first - all[nWithin - 1].first < 1e-4f) ++nWithin;
+  const float radius = (all[nWithin - 1].first + all[nWithin].first) / 2;
+
+  const std::vector<MTVRhythmSpace::Neighbour> within = s.getWithinRadius(target.data(), radius);
+  ASSERT_EQ(nWithin, within.size());
+  for (size_t i = 0; i < within.size(); ++i) {
+    ASSERT_LE(within[i].distance, radius);
+    ASSERT_NEAR(all[i].first, within[i].distance, 1e-6);
+  }
+}
+
+TEST(MTVRhythmSpaceTests, WithinRadiusOfReportedDistance)
+{
+  MTVRhythmSpace scanned(TimeSignature(3, 4), Unit::SEMIQUAVER);
+  MTVRhythmSpace indexed(TimeSignature(3, 4), Unit::SEMIQUAVER);
+  scanned.fill();
+  indexed.enableIndex();
+  indexed.fill();
+
+  std::mt19937 random(29);
+  std::uniform_real_distribution<float> tensionDist(0.0f, 1.0f);
+  std::vector<Tension> target(12);
+
+  // off the level grid, so that the reported distances don't round-trip through radius * radius * nSteps
+  for (int i = 0; i < 200; ++i) {
+    for (Tension& t : target) t = tensionDist(random);
+
+    const MTVRhythmSpace::Neighbour closest = scanned.getKNearest(target.data(), 1).front();
+    const std::vector<MTVRhythmSpace::Neighbour> within = scanned.getWithinRadius(target.data(), closest.distance);
+    ASSERT_FALSE(within.empty());
+    ASSERT_EQ(closest.patternId, within.front().patternId);
+
+    // all reported distances are within the radius, and the next pattern's isn't
+    ASSERT_LE(within.back().distance, closest.distance);
+    const std::vector<MTVRhythmSpace::Neighbour> next = scanned.getKNearest(target.data(), within.size() + 1);
+    ASSERT_GT(next.back().distance, closest.distance);
+
+    const std::vector<MTVRhythmSpace::Neighbour> indexedWithin = indexed.getWithinRadius(target.data(), closest.distance);
+    ASSERT_EQ(within.size(), indexedWithin.size());
+    for (size_t j = 0; j < within.size(); ++j)
+      ASSERT_EQ(within[j].patternId, indexedWithin[j].patternId);
+  }
+
+  ASSERT_TRUE(scanned.getWithinRadius(target.data(), -1.0f).empty());
+  ASSERT_EQ(scanned.getPatternCount(), scanned.getWithinRadius(target.data(), 1.0f).size());
+}
+
+TEST(MTVRhythmSpaceTests, NeighbourIterator)
+{
+  MTVRhythmSpace s(TimeSignature(3, 4), Unit::SEMIQUAVER);
+  s.fill();
+
+  const Tension target[12] = { 0.0f, 0.8f, 0.6f, 0.9f, 0.1f, 0.5f, 0.7f, 1.0f, 0.2f, 0.4f, 0.3f, 0.6f };
+  const std::vector<MTVRhythmSpace::Neighbour> expected = s.getKNearest(target, 20);
+
+  MTVRhythmSpace::NeighbourIterator it = s.getNeighbours(target);
+  MTVRhythmSpace::Neighbour neighbour;
+
+  for (const MTVRhythmSpace::Neighbour& e : expected) {
+    ASSERT_TRUE(it.next(neighbour));
+    ASSERT_EQ(e.patternId, neighbour.patternId);
+    ASSERT_EQ(e.distance, neighbour.distance);
+  }
+
+  // the rest comes in order as well
+  size_t count = expected.size();
+  float prevDistance = neighbour.distance;
+  while (it.next(neighbour)) {
+    ASSERT_LE(prevDistance, neighbour.distance);
+    prevDistance = neighbour.distance;
+    ++count;
+  }
+
+  ASSERT_EQ(s.getPatternCount(), count);
+  ASSERT_FALSE(it.hasNext());
+}
+
+TEST(MTVRhythmSpaceTests, DistanceSamplerMatchesRandomPatternCloseTo)
+{
+  MTVRhythmSpace s(TimeSignature(3, 4), Unit::SEMIQUAVER);
+  s.fill();
+
+  const Tension target[12] = { 0.0f, 0.8f, 0.6f, 0.9f, 0.1f, 0.5f, 0.7f, 1.0f, 0.2f, 0.4f, 0.3f, 0.6f };
+  const float distanceSD = 0.2f;
+  const MTVRhythmSpace::DistanceSampler sampler = s.getDistanceSampler(target, distanceSD);
+
+  double totalProbability = 0.0;
+  size_t totalPatterns = 0;
+  for (size_t level = 0; level < sampler.getLevelCount(); ++level) {
+    totalProbability += sampler.getLevelProbability(level);
+    totalPatterns += sampler.getLevelPatternCount(level);
+    if (level > 0) {
+      ASSERT_LE(sampler.getLevelDistance(level - 1), sampler.getLevelDistance(level));
+    }
+  }
+
+  ASSERT_NEAR(1.0, totalProbability, 1e-9);
+  ASSERT_EQ(s.getPatternCount(), totalPatterns);
+
+  // both draw the same levels with the same frequencies (levels are compared by rounded distance, as 
+  // distinct squared distances may normalize to the same distance)
+  std::map<int, double> expected;
+  for (size_t level = 0; level < sampler.getLevelCount(); ++level)
+    expected[(int)std::lround(sampler.getLevelDistance(level) * 1e5)] += sampler.getLevelProbability(level);
+
+  auto levelOf = [&](PatternId patternId) {
+    return (int)std::lround(s.getDistance(target, s.getMTV(patternId)) * 1e5);
+  };
+
+  const int nDraws = 20000;
+  std::map<int, int> samplerCounts, queryCounts;
+  std::mt19937 random(41);
+  MTVRhythmSpace::QueryContext ctx(MTVRhythmSpace::DistanceCacheMode::PARTIAL_SORT, 43);
+
+  for (int i = 0; i < nDraws; ++i) {
+    ++samplerCounts[levelOf(sampler.draw(random))];
+    ++queryCounts[levelOf(s.getRandomPatternCloseTo(target, ctx, distanceSD))];
+  }
+
+  for (const auto& level : expected) {
+    ASSERT_NEAR(level.second, (double)samplerCounts[level.first] / nDraws, 0.015);
+    ASSERT_NEAR(level.second, (double)queryCounts[level.first] / nDraws, 0.015);
+  }
+}
+
+TEST(MTVRhythmSpaceTests, DistanceHistogram)
+{
+  MTVRhythmSpace s(TimeSignature(3, 4), Unit::SEMIQUAVER);
+  s.fill();
+
+  // on the level grid (its tensions aren't exact in binary, so distinct levels may normalize to the same distance)
+  const std::vector<Tension> target(s.getMTV(createPattern<12>("x--x-x--x-x-")), s.getMTV(createPattern<12>("x--x-x--x-x-")) + 12);
+  const std::vector<MTVRhythmSpace::DistanceLevel> histogram = s.getDistanceHistogram(target.data());
+
+  ASSERT_EQ(0.0f, histogram.front().distance);
+  ASSERT_EQ(s.getPatternCount(), histogram.back().cumulativeCount);
+
+  PatternId total = 0;
+  for (size_t i = 0; i < histogram.size(); ++i) {
+    total += histogram[i].count;
+    ASSERT_EQ(total, histogram[i].cumulativeCount);
+    if (i > 0) {
+      ASSERT_LE(histogram[i - 1].distance, histogram[i].distance);
+    }
+  }
+
+  // counts match the radius query, whether streamed or looked up
+  for (size_t i = 0; i + 1 < histogram.size(); i += 3) {
+    const float distance = (histogram[i].distance + histogram[i + 1].distance) / 2;
+    if (!(distance < histogram[i + 1].distance)) continue;  // no float between the two levels
+    ASSERT_EQ(histogram[i].cumulativeCount, s.getWithinRadius(target.data(), distance).size());
+    ASSERT_EQ(histogram[i].cumulativeCount, s.countWithinDistance(target.data(), distance));
+    ASSERT_EQ(histogram[i].cumulativeCount, MTVRhythmSpace::countWithinDistance(histogram, distance));
+  }
+
+  ASSERT_EQ(0, MTVRhythmSpace::countWithinDistance(histogram, -1.0f));
+  ASSERT_EQ(s.getPatternCount(), MTVRhythmSpace::countWithinDistance(histogram, 1.0f));
+}
+
+TEST(MTVRhythmSpaceTests, DistanceHistogramOffGrid)
+{
+  MTVRhythmSpace s(TimeSignature(3, 4), Unit::SEMIQUAVER);
+  s.fill();
+
+  std::mt19937 random(31);
+  std::uniform_real_distribution<float> tensionDist(0.0f, 1.0f);
+  std::vector<Tension> target(12);
+
+  for (int i = 0; i < 5; ++i) {
+    for (Tension& t : target) t = tensionDist(random);
+
+    // same levels as the sampler
+    const std::vector<MTVRhythmSpace::DistanceLevel> histogram = s.getDistanceHistogram(target.data());
+    ASSERT_EQ(s.getDistanceSampler(target.data()).getLevelCount(), histogram.size());
+
+    // at every level distance, the looked up, streamed and radius counts agree
+    for (const MTVRhythmSpace::DistanceLevel& level : histogram) {
+      const PatternId count = MTVRhythmSpace::countWithinDistance(histogram, level.distance);
+      ASSERT_LE(level.cumulativeCount, count);
+      ASSERT_EQ(count, s.countWithinDistance(target.data(), level.distance));
+      ASSERT_EQ(count, s.getWithinRadius(target.data(), level.distance).size());
+    }
+  }
+}
+
+TEST(MTVRhythmSpaceTests, QuantizedDistanceKeys)
+{
+  MTVRhythmSpace space(TimeSignature(3, 4), Unit::SEMIQUAVER);
+  space.fill();
+
+  MTVRhythmSpace::QueryContext floatCtx(MTVRhythmSpace::DistanceCacheMode::FULL_SORT);
+  MTVRhythmSpace::QueryContext uint16Ctx, uint8Ctx;
+  uint16Ctx.setDistanceKeyFormat(MTVRhythmSpace::DistanceKeyFormat::UINT16_KEYS);
+  uint8Ctx.setDistanceKeyFormat(MTVRhythmSpace::DistanceKeyFormat::UINT8_KEYS);
+
+  std::mt19937 random(7);
+  std::uniform_real_distribution<float> tensionDist(0.0f, 1.0f);
+  std::vector<Tension> target(12);
+
+  for (int i = 0; i < 20; ++i) {
+    for (Tension& tension : target)
+      tension = tensionDist(random);
+
+    // the closest pattern is exact with any key format
+    const PatternId closest = space.getClosestPattern(target.data(), floatCtx);
+    ASSERT_EQ(closest, space.getClosestPattern(target.data(), uint16Ctx));
+    ASSERT_EQ(closest, space.getClosestPattern(target.data(), uint8Ctx));
+
+    // random picks fall within a key of the drawn distance, which with no deviation is the closest one
+    const float closestDistance = space.getDistance(target.data(), space.getMTV(closest));
+    for (int j = 0; j < 10; ++j) {
+      const PatternId pattern = space.getRandomPatternCloseTo(target.data(), uint8Ctx, 0.0f);
+      ASSERT_NEAR(closestDistance, space.getDistance(target.data(), space.getMTV(pattern)), 1.0f / 255);
+    }
+  }
+
+  // the key formats take 4 bytes per pattern (plus 4 per key offset and 2 per non-empty key), against 8 per 
+  // pattern for the float entries
+  const size_t nPatterns = (size_t)space.getPatternCount();
+  ASSERT_GE(floatCtx.getMemorySize(), nPatterns * 8);
+  ASSERT_LT(uint8Ctx.getMemorySize(), nPatterns * 5);
+  ASSERT_LT(uint16Ctx.getMemorySize(), nPatterns * 6 + 65537 * 4);
+}
@@ -0,0 +1,65 @@
+#include "gtest/gtest.h"
+#include "MTVRhythmSpaceRegistry.h"
+
+TEST(MTVRhythmSpaceRegistryTests, ReturnsSameSpaceForSameKey)
+{
+  MTVRhythmSpaceRegistry registry;
+  MTVRhythmSpaceRef s44 = registry.get(TimeSignature(4, 4), Unit::QUAVER);
+  MTVRhythmSpaceRef s68 = registry.get(TimeSignature(6, 8), Unit::QUAVER);
+  s44->fill();
+
+  ASSERT_NE(s44, s68);
+  ASSERT_EQ(s44, registry.get(TimeSignature(4, 4), Unit::get(8)));
+  ASSERT_TRUE(registry.get(TimeSignature(4, 4), Unit::QUAVER)->ready());
+  ASSERT_NE(s44, registry.get(TimeSignature(4, 4), Unit::SEMIQUAVER));
+  ASSERT_EQ(3, registry.size());
+}
+
+static size_t getFilledSize(const TimeSignature& ts)
+{
+  MTVRhythmSpace space(ts, Unit::SEMIQUAVER);
+  space.fill();
+  return space.getTotalMemorySize();
+}
+
+TEST(MTVRhythmSpaceRegistryTests, EvictsLeastRecentlyUsed)
+{
+  // 4/4 semiquavers take 2^16 * 16 * 4 bytes of points, plus the beat tables
+  const size_t size44 = getFilledSize(TimeSignature(4, 4));
+  const size_t size34 = getFilledSize(TimeSignature(3, 4));
+  const size_t size24 = getFilledSize(TimeSignature(2, 4));
+  ASSERT_LT((size_t)(1 << 16) * 16 * sizeof(Tension), size44);
+
+  MTVRhythmSpaceRegistry registry(size44 + size34);
+  MTVRhythmSpaceRef s44 = registry.get(TimeSignature(4, 4), Unit::SEMIQUAVER);
+  ASSERT_EQ(0, registry.getMemoryUsage());  // nothing is held until the space is filled
+  s44->fill();
+  registry.get(TimeSignature(3, 4), Unit::SEMIQUAVER)->fill();
+  ASSERT_EQ(size44 + size34, registry.getMemoryUsage());
+
+  // 4/4 is used again, so 3/4 is the least recently used space when 2/4 doesn't fit (once it's filled)
+  registry.get(TimeSignature(4, 4), Unit::SEMIQUAVER);
+  registry.get(TimeSignature(2, 4), Unit::SEMIQUAVER)->fill();
+  ASSERT_EQ(3, registry.size());
+  registry.evict();  // as the app does when a fill completes
+  ASSERT_EQ(2, registry.size());
+  ASSERT_EQ(size44 + size24, registry.getMemoryUsage());
+  ASSERT_EQ(s44, registry.find(TimeSignature(4, 4), Unit::SEMIQUAVER));
+  ASSERT_EQ(nullptr, registry.find(TimeSignature(3, 4), Unit::SEMIQUAVER));
+
+  // the most recently used space is kept, even over budget
+  registry.setMemoryBudget(0);
+  ASSERT_EQ(1, registry.size());
+  ASSERT_NE(nullptr, registry.find(TimeSignature(2, 4), Unit::SEMIQUAVER));
+}
+
+TEST(MTVRhythmSpaceRegistryTests, CountsIndexMemory)
+{
+  MTVRhythmSpaceRegistry registry;
+  MTVRhythmSpaceRef space = registry.get(TimeSignature(3, 4), Unit::SEMIQUAVER);
+  space->enableIndex();
+  space->fill();
+
+  ASSERT_EQ(space->getTotalMemorySize(), registry.getMemoryUsage());
+  ASSERT_LE(space->getMemorySize() + space->getIndex()->getMemorySize(), registry.getMemoryUsage());
+}
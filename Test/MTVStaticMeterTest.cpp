@@ -0,0 +1,83 @@
+#include "gtest/gtest.h"
+#include "MTVStaticMeter.h"
+#include "MTVRhythmSpace.h"
+#include <algorithm>
+#include <vector>
+
+template <int Num, int Den, int StepDen>
+static void checkStaticMeter()
+{
+  typedef MTVStaticMeter<Num, Den, StepDen> Meter;
+  const TimeSignature ts(Num, Den);
+  const UnitRef stepUnit = Unit::get(StepDen);
+  MeterTablesRef tables = MeterTables::get(ts, stepUnit);
+  ASSERT_EQ(tables->getNSteps(), Meter::N_STEPS);
+  ASSERT_EQ(tables->getNStepsPerBeat(), Meter::N_STEPS_PER_BEAT);
+  ASSERT_EQ(&Meter::computeMTV, getStaticMTVKernel(ts, stepUnit));
+
+  const NaturalDurationTable& naturalDurations = tables->getNaturalDurations();
+  for (int step = 0; step < Meter::N_STEPS; ++step)
+    ASSERT_EQ(naturalDurations.durations[step], Meter::NATURAL_DURATIONS[step]) << "step " << step;
+  for (int d = 0; d <= Meter::N_STEPS; ++d)
+    ASSERT_EQ(naturalDurations.fitting[d], Meter::FITTING_DURATIONS[d]) << "duration " << d;
+
+  const MetricalSalienceProfile prf = tables->getMetricalSalienceProfile(MTV_RHYTHM_SPACE_ROOT_SALIENCE);
+  const MetricalSalienceRange range(*std::min_element(prf.begin(), prf.end()), MTV_RHYTHM_SPACE_ROOT_SALIENCE);
+  for (int step = 0; step < Meter::N_STEPS; ++step)
+    ASSERT_EQ(salienceToTension(prf[step], range), Meter::TENSIONS[step]) << "step " << step;
+
+  // same mtvs as the runtime path, for all patterns
+  RhythmPattern rp(ts, stepUnit);
+  std::vector<Tension> expected(Meter::N_STEPS), actual(Meter::N_STEPS);
+
+  for (PatternId patternId = 0; patternId < (PatternId)1 << Meter::N_STEPS; ++patternId) {
+    rp.setPatternId(patternId);
+    computeMTV(rp, prf, range, expected.data());
+    Meter::computeMTV(patternId, actual.data());
+    ASSERT_EQ(expected, actual) << Num << "/" << Den << " in 1/" << StepDen << ", pattern " << patternId;
+  }
+}
+
+TEST(MTVStaticMeterTests, MatchRuntimeMeters)
+{
+  checkStaticMeter<4, 4, 16>();
+  checkStaticMeter<4, 4, 8>();
+  checkStaticMeter<4, 4, 4>();
+  checkStaticMeter<3, 4, 16>();
+  checkStaticMeter<3, 4, 8>();
+  checkStaticMeter<3, 4, 4>();
+  checkStaticMeter<6, 8, 16>();
+  checkStaticMeter<6, 8, 8>();
+}
+
+TEST(MTVStaticMeterTests, RuntimePathForOtherMeters)
+{
+  ASSERT_EQ(nullptr, getStaticMTVKernel(TimeSignature(5, 4), Unit::SEMIQUAVER));
+  ASSERT_EQ(nullptr, getStaticMTVKernel(TimeSignature(12, 8), Unit::SEMIQUAVER));
+  ASSERT_EQ(nullptr, getStaticMTVKernel(TimeSignature(4, 4), Unit::get(3, 16)));
+}
+
+TEST(MTVStaticMeterTests, SpaceUsesSpecialization)
+{
+  // a specialized space and the runtime mtvs agree, also for the implicit backend
+  MTVRhythmSpace space(TimeSignature(3, 4), Unit::SEMIQUAVER);
+  MTVRhythmSpace implicitSpace(TimeSignature(3, 4), Unit::SEMIQUAVER, MTVRhythmSpace::PointLayout::ROW_MAJOR,
+    MTVRhythmSpace::QueryBackend::IMPLICIT);
+  space.fill(nullptr, 1);
+  implicitSpace.fill();
+
+  MeterTablesRef tables = MeterTables::get(TimeSignature(3, 4), Unit::SEMIQUAVER);
+  const MetricalSalienceProfile prf = tables->getMetricalSalienceProfile(MTV_RHYTHM_SPACE_ROOT_SALIENCE);
+  const MetricalSalienceRange range(*std::min_element(prf.begin(), prf.end()), MTV_RHYTHM_SPACE_ROOT_SALIENCE);
+  RhythmPattern rp(TimeSignature(3, 4), Unit::SEMIQUAVER);
+  std::vector<Tension> expected(12), actual(12);
+
+  for (PatternId patternId = 0; patternId < space.getPatternCount(); patternId += 37) {
+    rp.setPatternId(patternId);
+    computeMTV(rp, prf, range, expected.data());
+    ASSERT_TRUE(space.getMTV(patternId, actual.data()));
+    ASSERT_EQ(expected, actual) << "pattern " << patternId;
+    ASSERT_TRUE(implicitSpace.getMTV(patternId, actual.data()));
+    ASSERT_EQ(expected, actual) << "pattern " << patternId;
+  }
+}
@@ -0,0 +1,118 @@
+#include "gtest/gtest.h"
+#include "MTVVPTree.h"
+#include "MTVRhythmSpace.h"
+#include <algorithm>
+#include <cmath>
+#include <random>
+#include <vector>
+
+static std::vector<MTVVPTree::Match> bruteForce(const std::vector<Tension>& points, int nDims, const Tension * target)
+{
+  // one kernel call per point, as the tree does
+  std::vector<MTVVPTree::Match> matches;
+  for (size_t i = 0; i < points.size() / nDims; ++i) {
+    float squaredDistance;
+    computeSquaredDistances(target, &points[i * nDims], 1, nDims, &squaredDistance);
+    matches.push_back({ squaredDistance, (PatternId)i });
+  }
+  std::sort(matches.begin(), matches.end());
+  return matches;
+}
+
+static std::vector<PatternId> getPatternIds(const std::vector<MTVVPTree::Match>& matches)
+{
+  std::vector<PatternId> patternIds;
+  for (const MTVVPTree::Match& match : matches)
+    patternIds.push_back(match.patternId);
+  return patternIds;
+}
+
+static std::vector<PatternId> getPatternIds(const std::vector<MTVRhythmSpace::Neighbour>& neighbours)
+{
+  std::vector<PatternId> patternIds;
+  for (const MTVRhythmSpace::Neighbour& neighbour : neighbours)
+    patternIds.push_back(neighbour.patternId);
+  return patternIds;
+}
+
+TEST(MTVVPTreeTests, MatchesBruteForce)
+{
+  const int nDims = 7;
+  const size_t nPoints = 3000;
+  std::mt19937 random(29);
+  std::uniform_real_distribution<float> tensionDist(0.0f, 1.0f);
+
+  // few distinct values per dimension, so that there are many equal distances (as in mtv spaces)
+  std::vector<Tension> points(nPoints * nDims);
+  for (Tension& t : points) t = std::round(tensionDist(random) * 4) / 4;
+
+  MTVVPTree tree(points.data(), nPoints, nDims);
+  ASSERT_EQ(nPoints * (sizeof(uint32_t) + sizeof(float)), tree.getMemorySize());
+  ASSERT_GE(tree.getBuildTime(), 0.0);
+
+  std::vector<Tension> target(nDims);
+  for (int i = 0; i < 20; ++i) {
+    for (Tension& t : target) t = tensionDist(random);
+    const std::vector<MTVVPTree::Match> expected = bruteForce(points, nDims, target.data());
+
+    const std::vector<MTVVPTree::Match> nearest = tree.findKNearest(target.data(), 10);
+    ASSERT_EQ(getPatternIds(std::vector<MTVVPTree::Match>(expected.begin(), expected.begin() + 10)), getPatternIds(nearest));
+    for (size_t j = 0; j < nearest.size(); ++j)
+      ASSERT_EQ(expected[j].squaredDistance, nearest[j].squaredDistance);
+
+    float squaredDistance;
+    ASSERT_EQ(expected[0].patternId, tree.findClosest(target.data(), &squaredDistance));
+    ASSERT_EQ(expected[0].squaredDistance, squaredDistance);
+
+    // a radius right at a distance level, which must be included as a whole
+    const float squaredRadius = expected[100].squaredDistance;
+    const size_t nWithin = std::upper_bound(expected.begin(), expected.end(), 
+      MTVVPTree::Match{ squaredRadius, ~0ULL }) - expected.begin();
+    ASSERT_EQ(getPatternIds(std::vector<MTVVPTree::Match>(expected.begin(), expected.begin() + nWithin)), 
+      getPatternIds(tree.findWithinRadius(target.data(), squaredRadius)));
+  }
+
+  ASSERT_EQ(nPoints, tree.findKNearest(target.data(), nPoints + 10).size());
+  ASSERT_TRUE(tree.findKNearest(target.data(), 0).empty());
+}
+
+TEST(MTVVPTreeTests, IndexedSpaceMatchesScan)
+{
+  MTVRhythmSpace scanned(TimeSignature(4, 4), Unit::SEMIQUAVER);
+  MTVRhythmSpace indexed(TimeSignature(4, 4), Unit::SEMIQUAVER);
+  indexed.enableIndex();
+  scanned.fill();
+  indexed.fill();
+  ASSERT_EQ(nullptr, scanned.getIndex());
+  ASSERT_NE(nullptr, indexed.getIndex());
+
+  std::mt19937 random(31);
+  std::uniform_real_distribution<float> tensionDist(0.0f, 1.0f);
+  std::vector<Tension> target(16);
+  MTVRhythmSpace::QueryContext ctx;
+
+  for (int i = 0; i < 20; ++i) {
+    for (Tension& t : target) t = tensionDist(random);
+
+    ASSERT_EQ(scanned.getClosestPattern(target.data(), ctx), indexed.getClosestPattern(target.data()));
+
+    const std::vector<MTVRhythmSpace::Neighbour> expected = scanned.getKNearest(target.data(), 15);
+    const std::vector<MTVRhythmSpace::Neighbour> actual = indexed.getKNearest(target.data(), 15);
+    ASSERT_EQ(getPatternIds(expected), getPatternIds(actual));
+    for (size_t j = 0; j < expected.size(); ++j)
+      ASSERT_EQ(expected[j].distance, actual[j].distance);
+
+    // radii at a distance level include all its patterns, on both paths
+    for (float radius : { expected.back().distance, expected[7].distance, 0.3f }) {
+      const std::vector<MTVRhythmSpace::Neighbour> expectedWithin = scanned.getWithinRadius(target.data(), radius);
+      ASSERT_EQ(getPatternIds(expectedWithin), getPatternIds(indexed.getWithinRadius(target.data(), radius)));
+    }
+  }
+
+  MTVRhythmSpace columnMajor(TimeSignature(3, 4), Unit::SEMIQUAVER, MTVRhythmSpace::PointLayout::COLUMN_MAJOR);
+  ASSERT_THROW(columnMajor.enableIndex(), std::runtime_error);
+
+  MTVRhythmSpace filled(TimeSignature(3, 4), Unit::SEMIQUAVER);
+  filled.fill();
+  ASSERT_THROW(filled.enableIndex(), std::runtime_error);
+}
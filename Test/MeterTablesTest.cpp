@@ -0,0 +1,63 @@
+#include "gtest/gtest.h"
+#include "MeterTables.h"
+#include "RhythmPattern.h"
+#include <thread>
+#include <vector>
+
+TEST(MeterTablesTests, MatchTimeSignature)
+{
+  const TimeSignature ts(6, 8);
+  MeterTablesRef tables = MeterTables::get(ts, Unit::SEMIQUAVER);
+
+  NaturalDurationsList pool;
+  ASSERT_EQ(12, tables->getNSteps());
+  ASSERT_EQ(2, tables->getNStepsPerBeat());
+  ASSERT_EQ(ts.getHierarchicalMeterSubdivisions(Unit::SEMIQUAVER), tables->getSubdivisions());
+  ASSERT_EQ(ts.getMetricalSalienceProfile(Unit::SEMIQUAVER), tables->getMetricalSalienceProfile());
+  ASSERT_EQ(ts.getMetricalSalienceProfile(Unit::SEMIQUAVER, 3), tables->getMetricalSalienceProfile(3));
+  ASSERT_EQ(ts.getNaturalDurationsMap(Unit::SEMIQUAVER, true, &pool), tables->getNaturalDurations(true).durations);
+  ASSERT_EQ(pool, tables->getNaturalDurations(true).pool);
+  pool.clear();
+  ASSERT_EQ(ts.getNaturalDurationsMap(Unit::SEMIQUAVER, false, &pool), tables->getNaturalDurations(false).durations);
+  ASSERT_EQ(pool, tables->getNaturalDurations(false).pool);
+}
+
+TEST(MeterTablesTests, SharedPerMeter)
+{
+  MeterTablesRef tables = MeterTables::get(TimeSignature(3, 4), Unit::QUAVER);
+  ASSERT_EQ(tables, MeterTables::get(TimeSignature(3, 4), Unit::get(8)));
+  ASSERT_NE(tables, MeterTables::get(TimeSignature(3, 4), Unit::SEMIQUAVER));
+  ASSERT_NE(tables, MeterTables::get(TimeSignature(6, 8), Unit::QUAVER));
+
+  // patterns of the same meter share the tables, also after a reset
+  RhythmPattern rp(TimeSignature(3, 4), Unit::QUAVER);
+  ASSERT_EQ(tables.get(), &rp.getMeterTables());
+  rp.reset(Unit::SEMIQUAVER);
+  ASSERT_EQ(MeterTables::get(TimeSignature(3, 4), Unit::SEMIQUAVER).get(), &rp.getMeterTables());
+}
+
+TEST(MeterTablesTests, ConcurrentGet)
+{
+  std::vector<MeterTablesRef> results(8);
+  std::vector<std::thread> threads;
+
+  for (size_t i = 0; i < results.size(); ++i)
+    threads.emplace_back([&results, i]() { results[i] = MeterTables::get(TimeSignature(12, 8), Unit::SEMIQUAVER); });
+
+  for (auto& thread : threads)
+    thread.join();
+
+  for (const MeterTablesRef& tables : results)
+    ASSERT_EQ(results.front(), tables);
+}
+
+TEST(MeterTablesTests, ThrowsForUnrepresentableMeter)
+{
+  ASSERT_ANY_THROW(MeterTables::get(TimeSignature(4, 4), Unit::SEMIBREVE));
+  ASSERT_ANY_THROW(MeterTables::get(TimeSignature(5, 4), Unit::QUAVER));
+
+  // tryGet doesn't throw, and caching the failure doesn't stop get from throwing
+  ASSERT_EQ(nullptr, MeterTables::tryGet(TimeSignature(5, 4), Unit::QUAVER));
+  ASSERT_ANY_THROW(MeterTables::get(TimeSignature(5, 4), Unit::QUAVER));
+  ASSERT_EQ(MeterTables::get(TimeSignature(3, 4), Unit::QUAVER).get(), MeterTables::tryGet(TimeSignature(3, 4), Unit::QUAVER));
+}
@@ -1,6 +1,8 @@
 #include "gtest/gtest.h"
 #include "RhythmPattern.h"
+#include <algorithm>
 #include <bitset>
+#include <random>
 
 template <int N>
 static PatternId createPattern(const std::string& str)
@@ -11,6 +13,34 @@ static PatternId createPattern(const std::string& str)
   return patternBitset.to_ullong();
 }
 
+// reference conversion to musical events, scanning the pattern step by step
+static MusicalEventList scanMusicalEvents(PatternId patternId, int nSteps, const NaturalDurationTable& naturalDurations, bool cyclic)
+{
+  MusicalEventList events;
+  int lo = 0;
+
+  while (lo < nSteps) {
+    // the longest pool duration within the natural duration that doesn't cross an onset
+    int hi = lo + 1;
+    for (int tmpHi = lo + 1; tmpHi <= lo + naturalDurations.durations[lo]; ++tmpHi) {
+      if (std::find(naturalDurations.pool.begin(), naturalDurations.pool.end(), tmpHi - lo) != naturalDurations.pool.end())
+        hi = tmpHi;
+      if ((patternId >> (tmpHi % nSteps)) & 1) break;
+    }
+
+    const bool onset = ((patternId >> lo) & 1) != 0;
+    const MusicalEventType type = onset ? MusicalEventType::NOTE
+      : (!events.empty() && events.back().type == MusicalEventType::NOTE ? MusicalEventType::TIED_NOTE : MusicalEventType::REST);
+    events.push_back(MusicalEvent(type, lo, hi - lo));
+    lo = hi;
+  }
+
+  if (cyclic && events.front().type == MusicalEventType::REST && events.back().type != MusicalEventType::REST)
+    events.front().type = MusicalEventType::TIED_NOTE;
+
+  return events;
+}
+
 
 TEST(RhythmPatternTests, StepCount)
 {
@@ -40,6 +70,27 @@ TEST(RhythmPatternTests, ConstructorPatternId)
   ASSERT_EQ(expectedPattern, actualPattern);
 }
 
+TEST(RhythmPatternTests, ContextSensitiveMeters)
+{
+  // these meters have no hierarchical subdivisions (so no meter tables), but can still hold patterns
+  RhythmPattern r54(TimeSignature(5, 4), Unit::QUAVER, createPattern<10>("x--x-x--x-"));
+  ASSERT_EQ(10, r54.getNSteps());
+  ASSERT_EQ(createPattern<10>("x--x-x--x-"), r54.getPatternId());
+  ASSERT_TRUE(r54[3]);
+  ASSERT_FALSE(r54[4]);
+
+  RhythmPattern r78(TimeSignature(4, 4), Unit::QUAVER);
+  r78.reset(TimeSignature(7, 8));
+  r78.setPatternId(createPattern<7>("x-x-xx-"));
+  ASSERT_EQ(7, r78.getNSteps());
+  ASSERT_EQ(createPattern<7>("x-x-xx-"), r78.getPatternId());
+  ASSERT_TRUE(r78[5]);
+
+  // only the methods that need the tables throw
+  ASSERT_ANY_THROW(r54.getMeterTables());
+  ASSERT_ANY_THROW(r78.asMusicalEvents());
+}
+
 TEST(RhythmPatternTests, AsMusicalEvents)
 {
   PatternId patternId = createPattern<16>("x--x---x--x-x---");  // rumba clave
@@ -122,3 +173,57 @@ TEST(RhythmPatternTests, AsMusicalEventsNoCyclicNoTrim)
   MusicalEventList actualEvents = r.asMusicalEvents(false, false);
   ASSERT_EQ(expectedEvents, actualEvents);
 }
+
+TEST(RhythmPatternTests, AsMusicalEventsBufferMatchesVector)
+{
+  const NaturalDurationTable naturalDurations(TimeSignature(6, 8), Unit::SEMIQUAVER);
+  const NaturalDurationTable untrimmedNaturalDurations(TimeSignature(6, 8), Unit::SEMIQUAVER, false);
+  RhythmPattern r(TimeSignature(6, 8), Unit::SEMIQUAVER);
+  MusicalEventBuffer events;
+
+  for (PatternId patternId = 0; patternId < ((PatternId)1 << 12); patternId += 7) {
+    r.setPatternId(patternId);
+
+    for (bool cyclic : { false, true }) {
+      int nEvents = r.asMusicalEvents(events, naturalDurations, cyclic);
+      ASSERT_EQ(r.asMusicalEvents(cyclic, true), MusicalEventList(events.begin(), events.begin() + nEvents));
+
+      nEvents = r.asMusicalEvents(events, untrimmedNaturalDurations, cyclic);
+      ASSERT_EQ(r.asMusicalEvents(cyclic, false), MusicalEventList(events.begin(), events.begin() + nEvents));
+    }
+  }
+}
+
+TEST(RhythmPatternTests, SegmentPatternMatchesStepScan)
+{
+  const std::pair<TimeSignature, UnitRef> meters[] = {
+    { TimeSignature(4, 4), Unit::SEMIQUAVER },  // all patterns
+    { TimeSignature(6, 8), Unit::SEMIQUAVER },  // all patterns
+    { TimeSignature(12, 8), Unit::SEMIQUAVER },
+    { TimeSignature(16, 4), Unit::SEMIQUAVER }  // 64 steps
+  };
+
+  std::mt19937_64 random(3);
+  MusicalEventBuffer events;
+
+  for (const auto& meter : meters) {
+    const int nSteps = meter.first.getExactMeasureDuration(meter.second);
+    const bool exhaustive = nSteps <= 16;
+    const PatternId nPatterns = exhaustive ? (PatternId)1 << nSteps : 20000;
+
+    for (bool trim : { false, true }) {
+      const NaturalDurationTable naturalDurations(meter.first, meter.second, trim);
+
+      for (PatternId i = 0; i < nPatterns; ++i) {
+        PatternId patternId = exhaustive ? i : random();
+        if (nSteps < MAX_N_STEPS) patternId &= ((PatternId)1 << nSteps) - 1;
+
+        for (bool cyclic : { false, true }) {
+          const int nEvents = RhythmPattern::segmentPattern(patternId, nSteps, naturalDurations, events, cyclic);
+          ASSERT_EQ(scanMusicalEvents(patternId, nSteps, naturalDurations, cyclic), 
+            MusicalEventList(events.begin(), events.begin() + nEvents));
+        }
+      }
+    }
+  }
+}
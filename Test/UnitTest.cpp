@@ -0,0 +1,44 @@
+#include "gtest/gtest.h"
+#include "Unit.h"
+#include "RhythmPattern.h"
+#include <cstring>
+#include <type_traits>
+
+TEST(UnitTests, HandleMatchesUnitRef)
+{
+  const UnitRef units[] = { Unit::SEMIBREVE, Unit::MINIM, Unit::CROTCHET, Unit::QUAVER, Unit::SEMIQUAVER };
+
+  for (const UnitRef& unit : units) {
+    const UnitHandle handle(unit);
+    ASSERT_TRUE(handle.isValid());
+    ASSERT_EQ(unit.get(), &*handle);
+    ASSERT_EQ(unit, handle.getRef());
+    ASSERT_EQ(handle, UnitHandle(Unit::get(unit->getDenominator())));
+  }
+
+  ASSERT_NE(UnitHandle(Unit::QUAVER), UnitHandle(Unit::CROTCHET));
+  ASSERT_FALSE(UnitHandle().isValid());
+  ASSERT_FALSE(UnitHandle(Unit::get(3)).isValid());
+  ASSERT_EQ(nullptr, UnitHandle().getRef());
+}
+
+TEST(UnitTests, PatternsCopyAsValues)
+{
+  ASSERT_TRUE(std::is_trivially_copyable<UnitHandle>::value);
+  ASSERT_TRUE(std::is_trivially_copyable<TimeSignature>::value);
+  ASSERT_TRUE(std::is_trivially_copyable<RhythmPattern>::value);
+
+  // a bulk copy gives equal patterns that share the same meter tables
+  RhythmPattern patterns[4];
+  for (int i = 0; i < 4; ++i)
+    patterns[i] = RhythmPattern(TimeSignature(6, 8), Unit::SEMIQUAVER, (PatternId)i * 37);
+
+  RhythmPattern copies[4];
+  std::memcpy(copies, patterns, sizeof(patterns));
+
+  for (int i = 0; i < 4; ++i) {
+    ASSERT_EQ(patterns[i], copies[i]);
+    ASSERT_EQ(&patterns[i].getMeterTables(), &copies[i].getMeterTables());
+    ASSERT_EQ(patterns[i].asMusicalEvents(), copies[i].asMusicalEvents());
+  }
+}